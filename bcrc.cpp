@@ -54,18 +54,683 @@ are:
 
 #include <boost/crc.hpp>
 #include <inttypes.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <time.h>
+#include <math.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <vector>
+#include <string>
+#include <map>
+#include <algorithm>
+#include <pthread.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+/*
+Parameters of a CRC, with the same meaning as the bcrc.new() arguments.
+*/
+struct CrcParams
+{
+    std::size_t bits;
+    uintmax_t poly;
+    uintmax_t initial;
+    uintmax_t xor_;
+    bool reflect_input;
+    bool reflect_remainder;
+};
+
+template < class BoostCrc >
+static CrcParams crc_params(const BoostCrc& crc)
+{
+    CrcParams p;
+    p.bits = BoostCrc::bit_count;
+    p.poly = crc.get_truncated_polynominal();
+    p.initial = crc.get_initial_remainder();
+    p.xor_ = crc.get_final_xor_value();
+    p.reflect_input = crc.get_reflect_input();
+    p.reflect_remainder = crc.get_reflect_remainder();
+    return p;
+}
+
+/*
+Polynomial arithmetic over GF(2) modulo a crc's polynomial, in normal
+(unreflected) bit order, where bit i is the coefficient of x^i.
+*/
+class Gf2
+{
+    private:
+
+        /* x^(2^k) mod P */
+        uintmax_t x2n_[64];
+
+    public:
+
+        std::size_t bits;
+        uintmax_t poly;
+        uintmax_t top;
+        uintmax_t mask;
+
+        explicit Gf2(const CrcParams& p)
+            : bits(p.bits), top((uintmax_t) 1 << (p.bits - 1)), mask(top | (top - 1))
+        {
+            poly = p.poly & mask;
+            x2n_[0] = bits > 1 ? 2 : poly;
+            for(int k = 1; k < 64; k++) {
+                x2n_[k] = mulmod(x2n_[k-1], x2n_[k-1]);
+            }
+        }
+
+        /* a * x mod P */
+        uintmax_t mulx(uintmax_t a) const
+        {
+            return ((a << 1) & mask) ^ (a & top ? poly : 0);
+        }
+
+        /* a * b mod P */
+        uintmax_t mulmod(uintmax_t a, uintmax_t b) const
+        {
+            uintmax_t r = 0;
+            a &= mask;
+            b &= mask;
+            for(uintmax_t bit = top; bit; bit >>= 1) {
+                r = mulx(r);
+                if(a & bit)
+                    r ^= b;
+            }
+            return r;
+        }
+
+        /* x^n mod P */
+        uintmax_t xpow(uint64_t n) const
+        {
+            uintmax_t r = 1;
+            for(int k = 0; n; k++, n >>= 1) {
+                if(n & 1)
+                    r = mulmod(r, x2n_[k]);
+            }
+            return r & mask;
+        }
+
+        /* Remainder after nbytes of zeros are appended to a message with remainder reg. */
+        uintmax_t shift(uintmax_t reg, uint64_t nbytes) const
+        {
+            return mulmod(reg, xpow(8 * nbytes));
+        }
+
+        /*
+        Remainder after n copies of a byte are appended to a message with
+        remainder reg, in O(log n). The byte is in the order it enters the
+        register, so reflected if the crc reflects its input.
+        */
+        uintmax_t repeat(uintmax_t reg, uint64_t n, unsigned char byte) const
+        {
+            uintmax_t x8 = xpow(8);
+            uintmax_t c = 0;
+            /* p = x^(8m), s = 1 + x^8 + ... + x^(8(m-1)), for m the leading bits of n */
+            uintmax_t p = 1;
+            uintmax_t s = 0;
+
+            for(int j = 0; j < 8; j++) {
+                if(byte >> j & 1)
+                    c ^= xpow(bits + j);
+            }
+
+            for(int k = 63; k >= 0; k--) {
+                s = mulmod(s, 1 ^ p);
+                p = mulmod(p, p);
+                if(n >> k & 1) {
+                    s = mulmod(s, x8) ^ 1;
+                    p = mulmod(p, x8);
+                }
+            }
+
+            return mulmod(reg, p) ^ mulmod(c, s);
+        }
+
+        static uintmax_t reflect(uintmax_t v, std::size_t bits)
+        {
+            uintmax_t r = 0;
+            for(std::size_t i = 0; i < bits; i++, v >>= 1) {
+                r = (r << 1) | (v & 1);
+            }
+            return r;
+        }
+};
+
+#if defined(__x86_64__) || defined(__i386__)
+/* Transpose 16 rows of 16 bytes, leaving column j in v[nibble_reverse[j]]. */
+static const unsigned char nibble_reverse[16] = { 0, 8, 4, 12, 2, 10, 6, 14, 1, 9, 5, 13, 3, 11, 7, 15 };
+
+__attribute__((target("ssse3")))
+static void transpose16(__m128i v[16])
+{
+    __m128i t[16];
+
+    for(int i = 0; i < 8; i++) {
+        t[i] = _mm_unpacklo_epi8(v[2 * i], v[2 * i + 1]);
+        t[i + 8] = _mm_unpackhi_epi8(v[2 * i], v[2 * i + 1]);
+    }
+    for(int i = 0; i < 8; i++) {
+        v[i] = _mm_unpacklo_epi16(t[2 * i], t[2 * i + 1]);
+        v[i + 8] = _mm_unpackhi_epi16(t[2 * i], t[2 * i + 1]);
+    }
+    for(int i = 0; i < 8; i++) {
+        t[i] = _mm_unpacklo_epi32(v[2 * i], v[2 * i + 1]);
+        t[i + 8] = _mm_unpackhi_epi32(v[2 * i], v[2 * i + 1]);
+    }
+    for(int i = 0; i < 8; i++) {
+        v[i] = _mm_unpacklo_epi64(t[2 * i], t[2 * i + 1]);
+        v[i + 8] = _mm_unpackhi_epi64(t[2 * i], t[2 * i + 1]);
+    }
+}
+
+/*
+Crcs of at most 16 bits of the first n bytes of 16 messages at once, one in
+each byte lane of a vector. The register of a lane is two bytes: a, that the
+message byte is xored into, and c, that the next step carries into a, or
+nothing unless wide. Each step looks up a 256 entry table as two 16 entry
+tables, one for each nibble of the index, with byte shuffles, so there are
+no large tables to miss in cache. ta and tc are the bytes of the table
+entries for a and c, the 16 entries of the low nibble then those of the high.
+*/
+__attribute__((target("ssse3")))
+static void nibble_crc16x16(const unsigned char ta[32], const unsigned char tc[32], bool wide,
+        const unsigned char* const* msg, std::size_t n, unsigned char a[16], unsigned char c[16])
+{
+    const __m128i mask = _mm_set1_epi8(0x0F);
+    const __m128i talo = _mm_loadu_si128((const __m128i*) ta);
+    const __m128i tahi = _mm_loadu_si128((const __m128i*) (ta + 16));
+    const __m128i tclo = _mm_loadu_si128((const __m128i*) tc);
+    const __m128i tchi = _mm_loadu_si128((const __m128i*) (tc + 16));
+    __m128i va = _mm_loadu_si128((const __m128i*) a);
+    __m128i vc = _mm_loadu_si128((const __m128i*) c);
+
+    for(std::size_t k = 0; k < n; k += 16) {
+        std::size_t m = std::min(n - k, (std::size_t) 16);
+        __m128i v[16];
+
+        for(int i = 0; i < 16; i++) {
+            if(m == 16) {
+                v[i] = _mm_loadu_si128((const __m128i*) (msg[i] + k));
+            } else if(m == 8) {
+                v[i] = _mm_loadl_epi64((const __m128i*) (msg[i] + k));
+            } else {
+                unsigned char row[16] = { 0 };
+                memcpy(row, msg[i] + k, m);
+                v[i] = _mm_loadu_si128((const __m128i*) row);
+            }
+        }
+
+        transpose16(v);
+
+        for(std::size_t j = 0; j < m; j++) {
+            __m128i x = _mm_xor_si128(va, v[nibble_reverse[j]]);
+            __m128i lo = _mm_and_si128(x, mask);
+            __m128i hi = _mm_and_si128(_mm_srli_epi16(x, 4), mask);
+
+            va = _mm_xor_si128(_mm_shuffle_epi8(talo, lo), _mm_shuffle_epi8(tahi, hi));
+            if(wide) {
+                va = _mm_xor_si128(va, vc);
+                vc = _mm_xor_si128(_mm_shuffle_epi8(tclo, lo), _mm_shuffle_epi8(tchi, hi));
+            }
+        }
+    }
+
+    _mm_storeu_si128((__m128i*) a, va);
+    _mm_storeu_si128((__m128i*) c, vc);
+}
+
+static bool have_ssse3()
+{
+    static const bool have = __builtin_cpu_supports("ssse3");
+    return have;
+}
+#else
+static void nibble_crc16x16(const unsigned char*, const unsigned char*, bool,
+        const unsigned char* const*, std::size_t, unsigned char*, unsigned char*)
+{
+}
+
+static bool have_ssse3()
+{
+    return false;
+}
+#endif
+
+/*
+Byte at a time table driven crc, for any width up to 64 bits. A crc that
+reflects its input keeps its register reflected, in the low bits, otherwise
+the register is kept in the high bits of 64, so the byte to look up is always
+at one end.
+
+Long buffers are processed as several streams at once, so the table lookups
+of one stream don't wait on those of another, without needing carry-less
+multiplication. See braid().
+*/
+class CrcTable
+{
+    private:
+
+        enum { LANES = 4, LANE = 1024 };
+
+        /* the table, either owned, or shared with other processes */
+        uint64_t* own_;
+        const uint64_t* table_;
+        /* tables advancing a register over LANE zero bytes, a byte at a time, built on first use */
+        mutable uint64_t* shift_;
+
+        CrcTable& operator=(const CrcTable&);
+
+        uint64_t serial(uint64_t reg, const unsigned char* b, std::size_t n) const
+        {
+            if(p.reflect_input) {
+                for(std::size_t i = 0; i < n; i++) {
+                    reg = (reg >> 8) ^ table_[(reg ^ b[i]) & 0xFF];
+                }
+            } else {
+                for(std::size_t i = 0; i < n; i++) {
+                    reg = (reg << 8) ^ table_[(reg >> 56) ^ b[i]];
+                }
+            }
+            return reg;
+        }
+
+        const uint64_t* shifts() const
+        {
+            uint64_t* shift = __atomic_load_n(&shift_, __ATOMIC_ACQUIRE);
+
+            if(shift)
+                return shift;
+
+            /* advancing is linear, so is the xor of advancing each bit */
+            static const unsigned char zeros[LANE] = { 0 };
+            uint64_t bit[64];
+
+            for(int j = 0; j < 64; j++) {
+                bit[j] = serial((uint64_t) 1 << j, zeros, LANE);
+            }
+
+            shift = new uint64_t[8 * 256];
+            for(int i = 0; i < 8; i++) {
+                uint64_t* t = shift + 256 * i;
+                t[0] = 0;
+                for(unsigned v = 1; v < 256; v++) {
+                    t[v] = t[v & (v - 1)] ^ bit[8 * i + __builtin_ctz(v)];
+                }
+            }
+
+            uint64_t* expected = NULL;
+            if(!__atomic_compare_exchange_n(&shift_, &expected, shift, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                delete[] shift;
+                shift = expected;
+            }
+
+            return shift;
+        }
+
+        /* The register advanced over LANE zero bytes. */
+        uint64_t shift(const uint64_t* tables, uint64_t reg) const
+        {
+            uint64_t r = 0;
+            for(int i = 0; i < 8; i++, reg >>= 8) {
+                r ^= tables[256 * i + (reg & 0xFF)];
+            }
+            return r;
+        }
+
+        /*
+        Process blocks of LANES * LANE bytes, each as LANES streams of LANE
+        bytes, a byte of each in turn, all but the first starting from a zero
+        register. Processing is linear, so the crc of the block is each
+        stream's register advanced over the streams following it, xored.
+        */
+        uint64_t braid(uint64_t reg, const unsigned char* b, std::size_t n) const
+        {
+            const uint64_t* tables = shifts();
+
+            for(; n >= LANES * LANE; n -= LANES * LANE, b += LANES * LANE) {
+                const unsigned char* b1 = b + LANE;
+                const unsigned char* b2 = b + 2 * LANE;
+                const unsigned char* b3 = b + 3 * LANE;
+                uint64_t r0 = reg;
+                uint64_t r1 = 0;
+                uint64_t r2 = 0;
+                uint64_t r3 = 0;
+
+                if(p.reflect_input) {
+                    for(std::size_t k = 0; k < LANE; k++) {
+                        r0 = (r0 >> 8) ^ table_[(r0 ^ b[k]) & 0xFF];
+                        r1 = (r1 >> 8) ^ table_[(r1 ^ b1[k]) & 0xFF];
+                        r2 = (r2 >> 8) ^ table_[(r2 ^ b2[k]) & 0xFF];
+                        r3 = (r3 >> 8) ^ table_[(r3 ^ b3[k]) & 0xFF];
+                    }
+                } else {
+                    for(std::size_t k = 0; k < LANE; k++) {
+                        r0 = (r0 << 8) ^ table_[(r0 >> 56) ^ b[k]];
+                        r1 = (r1 << 8) ^ table_[(r1 >> 56) ^ b1[k]];
+                        r2 = (r2 << 8) ^ table_[(r2 >> 56) ^ b2[k]];
+                        r3 = (r3 << 8) ^ table_[(r3 >> 56) ^ b3[k]];
+                    }
+                }
+
+                reg = shift(tables, shift(tables, shift(tables, r0) ^ r1) ^ r2) ^ r3;
+            }
+
+            return serial(reg, b, n);
+        }
+
+    public:
+
+        CrcParams p;
+        /* initial register */
+        uint64_t init;
+
+        /* Fill in the 256 entries of a table for the parameters. */
+        static void build(const CrcParams& p, uint64_t* table)
+        {
+            uint64_t mask = p.bits < 64 ? ((uint64_t) 1 << p.bits) - 1 : ~(uint64_t) 0;
+            uint64_t poly = p.poly & mask;
+
+            if(p.reflect_input) {
+                uint64_t rpoly = Gf2::reflect(poly, p.bits);
+                for(unsigned i = 0; i < 256; i++) {
+                    uint64_t r = i;
+                    for(int k = 0; k < 8; k++) {
+                        r = (r >> 1) ^ (r & 1 ? rpoly : 0);
+                    }
+                    table[i] = r;
+                }
+            } else {
+                uint64_t top = poly << (64 - p.bits);
+                for(unsigned i = 0; i < 256; i++) {
+                    uint64_t r = (uint64_t) i << 56;
+                    for(int k = 0; k < 8; k++) {
+                        r = (r << 1) ^ (r >> 63 ? top : 0);
+                    }
+                    table[i] = r;
+                }
+            }
+        }
+
+        /* A table is built for the parameters, unless one is shared. */
+        explicit CrcTable(const CrcParams& p_, const uint64_t* shared = NULL)
+            : own_(NULL), table_(shared), shift_(NULL), p(p_)
+        {
+            if(!table_) {
+                own_ = new uint64_t[256];
+                build(p, own_);
+                table_ = own_;
+            }
+            init = reg(p.initial);
+        }
+
+        CrcTable(const CrcTable& t) : own_(NULL), table_(t.table_), shift_(NULL), p(t.p), init(t.init)
+        {
+            if(t.own_) {
+                own_ = new uint64_t[256];
+                memcpy(own_, t.own_, 256 * sizeof(*own_));
+                table_ = own_;
+            }
+        }
+
+        ~CrcTable()
+        {
+            delete[] own_;
+            delete[] shift_;
+        }
+
+        /* The register for a remainder in normal bit order, and back. */
+        uint64_t reg(uint64_t remainder) const
+        {
+            uint64_t mask = p.bits < 64 ? ((uint64_t) 1 << p.bits) - 1 : ~(uint64_t) 0;
+
+            if(p.reflect_input)
+                return Gf2::reflect(remainder & mask, p.bits);
+            return (remainder & mask) << (64 - p.bits);
+        }
+
+        uint64_t remainder(uint64_t reg) const
+        {
+            if(p.reflect_input)
+                return Gf2::reflect(reg, p.bits);
+            return reg >> (64 - p.bits);
+        }
+
+        uint64_t step(uint64_t reg, unsigned char b) const
+        {
+            if(p.reflect_input)
+                return (reg >> 8) ^ table_[(reg ^ b) & 0xFF];
+            return (reg << 8) ^ table_[(reg >> 56) ^ b];
+        }
+
+        uint64_t process(uint64_t reg, const unsigned char* b, std::size_t n) const
+        {
+            if(n >= 2 * LANES * LANE)
+                return braid(reg, b, n);
+            return serial(reg, b, n);
+        }
+
+        /* The checksum of a register. */
+        uint64_t checksum(uint64_t reg) const
+        {
+            if(!p.reflect_input)
+                reg >>= 64 - p.bits;
+            if(p.reflect_input != p.reflect_remainder)
+                reg = Gf2::reflect(reg, p.bits);
+            return reg ^ p.xor_;
+        }
+
+        /*
+        The checksums of the messages in each group of 16 of n, for crcs of
+        at most 16 bits, see nibble_crc16x16(). Returns the count of
+        messages checksummed.
+        */
+        std::size_t nibble_checksums(const unsigned char* const* msg, const std::size_t* len, std::size_t n, uint64_t* out) const
+        {
+            /* a is the low byte of a reflected register, the high byte of a normal one */
+            int ashift = p.reflect_input ? 0 : 8;
+            int cshift = 8 - ashift;
+            int regshift = p.reflect_input ? 0 : 48;
+            unsigned char ta[32];
+            unsigned char tc[32];
+
+            for(unsigned j = 0; j < 16; j++) {
+                ta[j] = table_[j] >> regshift >> ashift;
+                tc[j] = table_[j] >> regshift >> cshift;
+                ta[j + 16] = table_[j << 4] >> regshift >> ashift;
+                tc[j + 16] = table_[j << 4] >> regshift >> cshift;
+            }
+
+            std::size_t i = 0;
+
+            for(; i + 16 <= n; i += 16) {
+                std::size_t common = *std::min_element(len + i, len + i + 16);
+                unsigned char a[16];
+                unsigned char c[16];
+
+                memset(a, init >> regshift >> ashift, 16);
+                memset(c, init >> regshift >> cshift, 16);
+
+                nibble_crc16x16(ta, tc, p.bits > 8, msg + i, common, a, c);
+
+                for(unsigned k = 0; k < 16; k++) {
+                    uint64_t reg = ((uint64_t) a[k] << ashift | (uint64_t) c[k] << cshift) << regshift;
+                    out[i + k] = checksum(process(reg, msg[i + k] + common, len[i + k] - common));
+                }
+            }
+
+            return i;
+        }
+
+        /*
+        The checksums of n messages. Four messages are processed at once, a
+        byte of each in turn, so the table lookups of one don't wait on those
+        of another.
+        */
+        void checksums(const unsigned char* const* msg, const std::size_t* len, std::size_t n, uint64_t* out) const
+        {
+            std::size_t i = p.bits <= 16 && have_ssse3() ? nibble_checksums(msg, len, n, out) : 0;
+
+            for(; i + 4 <= n; i += 4) {
+                std::size_t common = std::min(std::min(len[i], len[i + 1]), std::min(len[i + 2], len[i + 3]));
+                const unsigned char* m0 = msg[i];
+                const unsigned char* m1 = msg[i + 1];
+                const unsigned char* m2 = msg[i + 2];
+                const unsigned char* m3 = msg[i + 3];
+                uint64_t r0 = init;
+                uint64_t r1 = init;
+                uint64_t r2 = init;
+                uint64_t r3 = init;
+
+                if(p.reflect_input) {
+                    for(std::size_t k = 0; k < common; k++) {
+                        r0 = (r0 >> 8) ^ table_[(r0 ^ m0[k]) & 0xFF];
+                        r1 = (r1 >> 8) ^ table_[(r1 ^ m1[k]) & 0xFF];
+                        r2 = (r2 >> 8) ^ table_[(r2 ^ m2[k]) & 0xFF];
+                        r3 = (r3 >> 8) ^ table_[(r3 ^ m3[k]) & 0xFF];
+                    }
+                } else {
+                    for(std::size_t k = 0; k < common; k++) {
+                        r0 = (r0 << 8) ^ table_[(r0 >> 56) ^ m0[k]];
+                        r1 = (r1 << 8) ^ table_[(r1 >> 56) ^ m1[k]];
+                        r2 = (r2 << 8) ^ table_[(r2 >> 56) ^ m2[k]];
+                        r3 = (r3 << 8) ^ table_[(r3 >> 56) ^ m3[k]];
+                    }
+                }
+
+                out[i] = checksum(process(r0, m0 + common, len[i] - common));
+                out[i + 1] = checksum(process(r1, m1 + common, len[i + 1] - common));
+                out[i + 2] = checksum(process(r2, m2 + common, len[i + 2] - common));
+                out[i + 3] = checksum(process(r3, m3 + common, len[i + 3] - common));
+            }
+
+            for(; i < n; i++) {
+                out[i] = checksum(process(init, msg[i], len[i]));
+            }
+        }
+};
 
 /*
 CRC wrapper, implementing a CRC interface. This is a work-around for the
 templatization of boost/crc, which creates a different type per CRC width.
 */
+struct CrcShadow;
+
 class Crc
 {
+    private:
+
+        mutable Gf2* gf2_;
+        mutable CrcTable* table_;
+
+        /*
+        Small appends are staged, and processed together when the stage fills,
+        or the crc is needed, saving a call into the implementation for each
+        of them.
+        */
+        enum { STAGE_SIZE = 64, STAGE_SMALL = 16 };
+
+        mutable unsigned char stage_[STAGE_SIZE];
+        mutable unsigned staged_;
+
+        void flush() const
+        {
+            if(staged_) {
+                unsigned n = staged_;
+                staged_ = 0;
+                const_cast<Crc*>(this)->do_process_bytes(stage_, n);
+            }
+        }
+
+    protected:
+
+        virtual void do_reset() = 0;
+        virtual void do_reset(uintmax_t remainder) = 0;
+        virtual void do_process_bytes(const void* buffer, size_t byte_count) = 0;
+        virtual uintmax_t do_checksum() const = 0;
+        virtual uintmax_t do_remainder() const = 0;
+
     public:
-        virtual ~Crc() {};
-        virtual void reset() = 0;
-        virtual void process_bytes(const void* buffer, size_t byte_count) = 0;
-        virtual uintmax_t checksum() const = 0;
+        /* Sampled verification against a reference, see crc:shadow(). */
+        CrcShadow* shadow;
+
+        Crc() : gf2_(NULL), table_(NULL), staged_(0), shadow(NULL) {};
+        Crc(const Crc& c) : gf2_(NULL), table_(NULL), staged_(c.staged_), shadow(NULL)
+        {
+            memcpy(stage_, c.stage_, staged_);
+        };
+        virtual ~Crc();
+
+        /* Arithmetic modulo the crc's polynomial, built on first use. */
+        const Gf2& gf2() const
+        {
+            if(!gf2_)
+                gf2_ = new Gf2(params());
+            return *gf2_;
+        }
+
+        /* A table driven engine for the crc's parameters, built on first use. */
+        const CrcTable& table() const
+        {
+            if(!table_)
+                table_ = new CrcTable(params());
+            return *table_;
+        }
+
+        virtual Crc* clone() const = 0;
+        virtual CrcParams params() const = 0;
+
+        void reset()
+        {
+            staged_ = 0;
+            do_reset();
+        }
+
+        void process_bytes(const void* buffer, size_t byte_count)
+        {
+            if(byte_count > STAGE_SMALL) {
+                flush();
+                do_process_bytes(buffer, byte_count);
+                return;
+            }
+            if(staged_ + byte_count > STAGE_SIZE)
+                flush();
+            memcpy(stage_ + staged_, buffer, byte_count);
+            staged_ += byte_count;
+        }
+
+        uintmax_t checksum() const
+        {
+            flush();
+            return do_checksum();
+        }
+
+        /* The interim remainder, in normal bit order, and restarting from one. */
+        uintmax_t remainder() const
+        {
+            flush();
+            return do_remainder();
+        }
+
+        void reset(uintmax_t remainder)
+        {
+            staged_ = 0;
+            do_reset(remainder);
+        }
 };
 
 template < std::size_t Bits >
@@ -75,319 +740,7268 @@ class CrcBasic : public Crc
 
         boost::crc_basic<Bits> crc_;
 
-    public:
+    public:
+
+        CrcBasic(
+                 uintmax_t truncated_polynominal,
+                 uintmax_t initial_remainder,
+                 uintmax_t final_xor_value,
+                 bool reflect_input,
+                 bool reflect_remainder
+            ) : crc_(
+                 truncated_polynominal,
+                 initial_remainder,
+                 final_xor_value,
+                 reflect_input,
+                 reflect_remainder
+            )
+        {
+        }
+
+        ~CrcBasic() {};
+
+        Crc* clone() const
+        {
+            return new CrcBasic(*this);
+        }
+
+        CrcParams params() const
+        {
+            return crc_params(crc_);
+        }
+
+    protected:
+
+        void do_reset()
+        {
+            crc_.reset();
+        }
+
+        void do_reset(uintmax_t remainder)
+        {
+            crc_.reset(remainder);
+        }
+
+        void do_process_bytes(const void* buffer, size_t byte_count)
+        {
+            crc_.process_bytes(buffer, byte_count);
+        }
+
+        uintmax_t do_checksum() const
+        {
+            return crc_.checksum();
+        }
+
+        uintmax_t do_remainder() const
+        {
+            return crc_.get_interim_remainder();
+        }
+};
+
+/*
+Bitwise crc for any parameters, or NULL if the width isn't supported.
+*/
+static Crc* crc_basic_new(const CrcParams& p)
+{
+    switch(p.bits) {
+        case  8: return new CrcBasic< 8>(p.poly, p.initial, p.xor_, p.reflect_input, p.reflect_remainder);
+        case 16: return new CrcBasic<16>(p.poly, p.initial, p.xor_, p.reflect_input, p.reflect_remainder);
+        case 24: return new CrcBasic<24>(p.poly, p.initial, p.xor_, p.reflect_input, p.reflect_remainder);
+        case 32: return new CrcBasic<32>(p.poly, p.initial, p.xor_, p.reflect_input, p.reflect_remainder);
+    }
+    return NULL;
+}
+
+/*
+Crc of at most 16 bits, looking up a byte's table entry as the xor of two
+entries of 16 entry tables, one for each of its nibbles. The tables are a
+fraction of the size of a 256 entry table, so stay in cache when crcs of
+short frames are interleaved with other work, and are much faster than the
+bitwise crc. The register is kept as in CrcTable, reflected in the low bits,
+or in the high 16 bits otherwise.
+*/
+class CrcNibbled : public Crc
+{
+    private:
+
+        CrcParams p_;
+        uint16_t lo_[16];
+        uint16_t hi_[16];
+        uint16_t mask_;
+        uint16_t reg_;
+        uint16_t init_;
+
+        uint16_t reg(uintmax_t remainder) const
+        {
+            remainder &= mask_;
+            if(p_.reflect_input)
+                return Gf2::reflect(remainder, p_.bits);
+            return remainder << (16 - p_.bits);
+        }
+
+    public:
+
+        enum { BRAID = 16384 };
+
+        explicit CrcNibbled(const CrcParams& p) : p_(p), mask_(((uint32_t) 1 << p.bits) - 1)
+        {
+            uint64_t table[256];
+            int shift = p.reflect_input ? 0 : 48;
+
+            p_.poly &= mask_;
+            p_.initial &= mask_;
+            p_.xor_ &= mask_;
+
+            CrcTable::build(p_, table);
+            for(unsigned j = 0; j < 16; j++) {
+                lo_[j] = table[j] >> shift;
+                hi_[j] = table[j << 4] >> shift;
+            }
+            init_ = reg_ = reg(p_.initial);
+        }
+
+        ~CrcNibbled() {};
+
+        Crc* clone() const
+        {
+            return new CrcNibbled(*this);
+        }
+
+        CrcParams params() const
+        {
+            return p_;
+        }
+
+    protected:
+
+        void do_reset()
+        {
+            reg_ = init_;
+        }
+
+        void do_reset(uintmax_t remainder)
+        {
+            reg_ = reg(remainder);
+        }
+
+        void do_process_bytes(const void* buffer, size_t byte_count)
+        {
+            const unsigned char* b = (const unsigned char*) buffer;
+            unsigned r = reg_;
+
+            /* long buffers are faster braided, with a full table */
+            if(byte_count >= BRAID) {
+                int shift = p_.reflect_input ? 0 : 48;
+                reg_ = table().process((uint64_t) r << shift, b, byte_count) >> shift;
+                return;
+            }
+
+            if(p_.reflect_input) {
+                for(std::size_t i = 0; i < byte_count; i++) {
+                    unsigned x = (r ^ b[i]) & 0xFF;
+                    r = (r >> 8) ^ lo_[x & 15] ^ hi_[x >> 4];
+                }
+            } else {
+                for(std::size_t i = 0; i < byte_count; i++) {
+                    unsigned x = (r >> 8) ^ b[i];
+                    r = ((r << 8) ^ lo_[x & 15] ^ hi_[x >> 4]) & 0xFFFF;
+                }
+            }
+
+            reg_ = r;
+        }
+
+        uintmax_t do_checksum() const
+        {
+            uintmax_t r = p_.reflect_input ? reg_ : reg_ >> (16 - p_.bits);
+            if(p_.reflect_input != p_.reflect_remainder)
+                r = Gf2::reflect(r, p_.bits);
+            return (r ^ p_.xor_) & mask_;
+        }
+
+        uintmax_t do_remainder() const
+        {
+            if(p_.reflect_input)
+                return Gf2::reflect(reg_, p_.bits);
+            return reg_ >> (16 - p_.bits);
+        }
+};
+
+/*
+A reference implementation to verify a sample of 1 in every n crc:process()
+calls against. A sampled call is rerun by the reference from the crc's
+register before it, and must end where the crc itself did.
+*/
+struct CrcShadow
+{
+    uint64_t every;
+    uint64_t countdown;
+    uint64_t samples;
+    uint64_t mismatches;
+    Crc* reference;
+    /* lua registry reference to the mismatch callback, or LUA_NOREF */
+    int callback;
+
+    CrcShadow(uint64_t every_, Crc* reference_, int callback_)
+        : every(every_), countdown(every_), samples(0), mismatches(0),
+          reference(reference_), callback(callback_)
+    {
+    }
+
+    ~CrcShadow()
+    {
+        delete reference;
+    }
+
+    /* Whether this call is sampled. */
+    bool due()
+    {
+        if(--countdown)
+            return false;
+
+        countdown = every;
+        samples++;
+
+        return true;
+    }
+
+    /*
+    Whether the reference, processing the bytes from the remainder the crc had
+    before them, agrees with the crc's checksum after them.
+    */
+    bool check(uintmax_t before, const void* bytes, std::size_t size, const Crc* crc)
+    {
+        reference->reset(before);
+        reference->process_bytes(bytes, size);
+
+        if(reference->checksum() == crc->checksum())
+            return true;
+
+        mismatches++;
+
+        return false;
+    }
+};
+
+Crc::~Crc()
+{
+    delete gf2_;
+    delete table_;
+    delete shadow;
+}
+
+template < class Optimal >
+class CrcOptimal : public Crc
+{
+    private:
+
+        Optimal crc_;
+
+    public:
+
+        ~CrcOptimal() {};
+
+        Crc* clone() const
+        {
+            return new CrcOptimal(*this);
+        }
+
+        CrcParams params() const
+        {
+            return crc_params(crc_);
+        }
+
+    protected:
+
+        void do_reset()
+        {
+            crc_.reset();
+        }
+
+        void do_reset(uintmax_t remainder)
+        {
+            crc_.reset(remainder);
+        }
+
+        void do_process_bytes(const void* buffer, size_t byte_count)
+        {
+            crc_.process_bytes(buffer, byte_count);
+        }
+
+        uintmax_t do_checksum() const
+        {
+            return crc_.checksum();
+        }
+
+        uintmax_t do_remainder() const
+        {
+            return crc_.get_interim_remainder();
+        }
+};
+
+/*
+Crc tables shared by the processes of a host. The table for a polynomial is
+built once, in a shared memory segment named by a hash of the parameters it
+depends on, and mapped read-only by every process using it. The segment also
+holds the parameters, so a hash collision is detected, and it is marked ready
+only once it is complete. Its builder holds a lock on it until then, so one
+that died is detected, and the segment is only trusted if it belongs to the
+user and holds the right table.
+*/
+struct SharedTable
+{
+    enum { MAGIC = 0x54524342 /* "BCRT" */ };
+
+    uint32_t magic;
+    volatile uint32_t ready;
+    uint64_t bits;
+    uint64_t poly;
+    uint64_t reflect_input;
+    uint64_t table[256];
+
+    bool matches(const CrcParams& p) const
+    {
+        return magic == MAGIC && bits == p.bits && poly == p.poly && reflect_input == p.reflect_input;
+    }
+
+    /* The shared table for the parameters, or NULL if it can't be shared. */
+    static const uint64_t* get(const CrcParams& p)
+    {
+        static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+        static std::vector<const SharedTable*> mapped;
+        const uint64_t* table = NULL;
+
+        pthread_mutex_lock(&lock);
+
+        for(std::size_t i = 0; i < mapped.size() && !table; i++) {
+            if(mapped[i]->matches(p))
+                table = mapped[i]->table;
+        }
+
+        if(!table) {
+            const SharedTable* t = open(p);
+            if(t) {
+                mapped.push_back(t);
+                table = t->table;
+            }
+        }
+
+        pthread_mutex_unlock(&lock);
+
+        return table;
+    }
+
+    /* The name of the segment for the parameters. */
+    static void name(const CrcParams& p, char* name, std::size_t size)
+    {
+        uint64_t key[] = { p.bits, p.poly, p.reflect_input };
+        uint64_t hash = 14695981039346656037ULL;
+
+        for(std::size_t i = 0; i < sizeof(key); i++) {
+            hash = (hash ^ ((const unsigned char*) key)[i]) * 1099511628211ULL;
+        }
+        snprintf(name, size, "/bcrc-table-%016llx", (unsigned long long) hash);
+    }
+
+    static const SharedTable* open(const CrcParams& p)
+    {
+        char name[64];
+
+        SharedTable::name(p, name, sizeof(name));
+
+        /* a segment left by a builder that died, or corrupted, is built again */
+        for(int attempt = 0; attempt < 2; attempt++) {
+            bool stale = false;
+
+            /* the first process to get here builds the table */
+            int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+
+            if(fd >= 0)
+                return build(p, name, fd);
+            if(errno != EEXIST)
+                return NULL;
+
+            const SharedTable* t = attach(p, name, &stale);
+
+            if(t || !stale)
+                return t;
+            shm_unlink(name);
+        }
+
+        return NULL;
+    }
+
+    /*
+    Build the table in the new segment fd, holding an exclusive lock on it
+    until the table is ready, which the lock's release on exit tells apart
+    from a builder that died.
+    */
+    static const SharedTable* build(const CrcParams& p, const char* name, int fd)
+    {
+        void* m = MAP_FAILED;
+
+        if(flock(fd, LOCK_EX) == 0 && ftruncate(fd, sizeof(SharedTable)) == 0)
+            m = mmap(NULL, sizeof(SharedTable), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if(m == MAP_FAILED) {
+            shm_unlink(name);
+            close(fd);
+            return NULL;
+        }
+
+        SharedTable* t = (SharedTable*) m;
+        t->magic = MAGIC;
+        t->bits = p.bits;
+        t->poly = p.poly;
+        t->reflect_input = p.reflect_input;
+        CrcTable::build(p, t->table);
+        __sync_synchronize();
+        t->ready = 1;
+        close(fd);
+        mprotect(m, sizeof(SharedTable), PROT_READ);
+
+        return t;
+    }
+
+    /*
+    Map the segment built by another process, waiting up to a second for it
+    to be ready. Only a segment of this user is trusted, and its table must be
+    the one for the parameters. Sets stale if the segment should be rebuilt.
+    */
+    static const SharedTable* attach(const CrcParams& p, const char* name, bool* stale)
+    {
+        struct stat st;
+        int fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+
+        if(fd < 0)
+            return NULL;
+        if(fstat(fd, &st) < 0 || st.st_uid != geteuid()) {
+            close(fd);
+            return NULL;
+        }
+
+        /*
+        The builder sizes the segment only once it holds the lock, so an
+        unsized one may be one it has created but not yet locked, and is only
+        given up on if it stays unsized for the whole wait.
+        */
+        bool locked = false;
+        bool unsized = false;
+
+        for(int wait = 1000; wait > 0; wait--) {
+            unsized = false;
+            if(flock(fd, LOCK_SH | LOCK_NB) == 0) {
+                if(fstat(fd, &st) == 0 && st.st_size >= (off_t) sizeof(SharedTable)) {
+                    locked = true;
+                    break;
+                }
+                unsized = true;
+                flock(fd, LOCK_UN);
+            }
+            usleep(1000);
+        }
+
+        void* m = MAP_FAILED;
+        if(locked)
+            m = mmap(NULL, sizeof(SharedTable), PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+
+        if(m == MAP_FAILED) {
+            /* unlocked, but never sized by its builder */
+            *stale = unsized;
+            return NULL;
+        }
+
+        const SharedTable* t = (const SharedTable*) m;
+        uint64_t table[256];
+
+        CrcTable::build(p, table);
+        __sync_synchronize();
+
+        /* a ready segment for other parameters is a hash collision */
+        if(!t->ready || t->magic != MAGIC || (t->matches(p) && memcmp(t->table, table, sizeof(table)) != 0))
+            *stale = true;
+        if(*stale || !t->matches(p)) {
+            munmap(m, sizeof(SharedTable));
+            return NULL;
+        }
+
+        return t;
+    }
+};
+
+/*
+Table driven crc for any parameters, its table optionally shared, see
+SharedTable.
+*/
+class CrcTabled : public Crc
+{
+    private:
+
+        CrcTable engine_;
+        uint64_t reg_;
+
+    public:
+
+        CrcTabled(const CrcParams& p, const uint64_t* shared)
+            : engine_(p, shared), reg_(engine_.init)
+        {
+        }
+
+        ~CrcTabled() {};
+
+        Crc* clone() const
+        {
+            return new CrcTabled(*this);
+        }
+
+        CrcParams params() const
+        {
+            return engine_.p;
+        }
+
+    protected:
+
+        void do_reset()
+        {
+            reg_ = engine_.init;
+        }
+
+        void do_reset(uintmax_t remainder)
+        {
+            reg_ = engine_.reg(remainder);
+        }
+
+        void do_process_bytes(const void* buffer, size_t byte_count)
+        {
+            reg_ = engine_.process(reg_, (const unsigned char*) buffer, byte_count);
+        }
+
+        uintmax_t do_checksum() const
+        {
+            return engine_.checksum(reg_);
+        }
+
+        uintmax_t do_remainder() const
+        {
+            return engine_.remainder(reg_);
+        }
+};
+
+/*
+Location and byte order of a CRC embedded in a frame, either after the bytes
+it covers (the tail), or before them (the head).
+*/
+struct FrameCrc
+{
+    std::size_t size;
+    bool little;
+    bool head;
+
+    uintmax_t get(const unsigned char* at) const
+    {
+        uintmax_t v = 0;
+        for(std::size_t i = 0; i < size; i++) {
+            v |= (uintmax_t) at[i] << (8 * (little ? i : size - 1 - i));
+        }
+        return v;
+    }
+
+    void put(unsigned char* at, uintmax_t v) const
+    {
+        for(std::size_t i = 0; i < size; i++) {
+            at[i] = (unsigned char) (v >> (8 * (little ? i : size - 1 - i)));
+        }
+    }
+
+    /* Bytes covered by the crc in a frame of len bytes, len >= size. */
+    const void* payload(const void* frame) const
+    {
+        return (const char*) frame + (head ? size : 0);
+    }
+
+    /* Where the crc is stored in a frame of len bytes, len >= size. */
+    const unsigned char* at(const void* frame, std::size_t len) const
+    {
+        return (const unsigned char*) frame + (head ? 0 : len - size);
+    }
+
+    bool verify(Crc* crc, const void* frame, std::size_t len) const
+    {
+        if(len < size)
+            return false;
+        crc->reset();
+        crc->process_bytes(payload(frame), len - size);
+        return crc->checksum() == get(at(frame, len));
+    }
+};
+
+/*
+Input bytes, either borrowed from elsewhere (a lua string), or a file mapped
+read-only into memory.
+*/
+struct Mapping
+{
+    const unsigned char* data;
+    std::size_t size;
+    void* base;
+
+    Mapping() : data(NULL), size(0), base(NULL) {}
+
+    ~Mapping()
+    {
+        if(base)
+            munmap(base, size);
+    }
+
+    void borrow(const void* data_, std::size_t size_)
+    {
+        data = (const unsigned char*) data_;
+        size = size_;
+    }
+
+    /* Returns 0, or an errno. */
+    int map(const char* path)
+    {
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        struct stat st;
+
+        if(fd < 0)
+            return errno;
+
+        if(fstat(fd, &st) < 0) {
+            int err = errno;
+            close(fd);
+            return err;
+        }
+
+        size = st.st_size;
+        data = (const unsigned char*) "";
+
+        if(size > 0) {
+            base = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+            if(base == MAP_FAILED) {
+                int err = errno;
+                base = NULL;
+                size = 0;
+                close(fd);
+                return err;
+            }
+            madvise(base, size, MADV_SEQUENTIAL);
+            data = (const unsigned char*) base;
+        }
+
+        close(fd);
+
+        return 0;
+    }
+};
+
+/*
+A stream of records, each with a length field, a fixed size header, a
+payload of the length, and optionally an embedded crc. The crc is either
+after the payload (the tail), or between the length field and header (the
+head). It covers the header and payload, and optionally the length field.
+*/
+struct RecordFormat
+{
+    enum { CRC_TAIL, CRC_HEAD, CRC_NONE };
+
+    std::size_t lenbytes;
+    bool lenlittle;
+    std::size_t header;
+    int crc_at;
+    bool cover_length;
+    FrameCrc frame;
+
+    std::size_t crcbytes() const
+    {
+        return crc_at == CRC_NONE ? 0 : frame.size;
+    }
+
+    /* Returns the size of the record at p, or 0 if it is incomplete. */
+    std::size_t next(const unsigned char* p, std::size_t avail) const
+    {
+        std::size_t overhead = lenbytes + header + crcbytes();
+        uint64_t len = 0;
+
+        if(avail < overhead)
+            return 0;
+
+        for(std::size_t i = 0; i < lenbytes; i++) {
+            len |= (uint64_t) p[i] << (8 * (lenlittle ? i : lenbytes - 1 - i));
+        }
+
+        if(len > avail - overhead)
+            return 0;
+
+        return overhead + len;
+    }
+
+    /* Checksum a record of size bytes, and return whether its crc is valid. */
+    bool check(Crc* crc, const unsigned char* p, std::size_t size, uintmax_t* sum) const
+    {
+        std::size_t body = lenbytes + (crc_at == CRC_HEAD ? frame.size : 0);
+
+        crc->reset();
+        if(cover_length)
+            crc->process_bytes(p, lenbytes);
+        crc->process_bytes(p + body, size - body - (crc_at == CRC_TAIL ? frame.size : 0));
+        *sum = crc->checksum();
+
+        switch(crc_at) {
+            case CRC_TAIL: return *sum == frame.get(p + size - frame.size);
+            case CRC_HEAD: return *sum == frame.get(p + lenbytes);
+        }
+        return true;
+    }
+};
+
+/*
+Single-producer, single-consumer ring of frames in POSIX shared memory, see
+bcrc.ring_consumer() for the layout.
+*/
+struct RingHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t capacity;
+    char pad0[48];
+    uint64_t head;
+    char pad1[56];
+    uint64_t tail;
+    char pad2[56];
+};
+
+class Ring
+{
+    private:
+
+        void* base_;
+        std::size_t size_;
+
+        Ring(void* base, std::size_t size)
+            : base_(base), size_(size), hdr((RingHeader*) base), data((unsigned char*) base + sizeof(RingHeader))
+        {
+            capacity = hdr->capacity;
+            head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+            tail = __atomic_load_n(&hdr->tail, __ATOMIC_ACQUIRE);
+            corrupt = false;
+        }
+
+    public:
+
+        enum { PAD = 0xFFFFFFFF, ALIGN = 8, VERSION = 1 };
+
+        RingHeader* hdr;
+        unsigned char* data;
+        uint64_t capacity;
+        /* Local copies of the positions, of which only one is ours to advance. */
+        uint64_t head;
+        uint64_t tail;
+        bool corrupt;
+
+        ~Ring()
+        {
+            munmap(base_, size_);
+        }
+
+        static uint64_t frame_size(std::size_t len)
+        {
+            return (4 + (uint64_t) len + ALIGN - 1) & ~(uint64_t) (ALIGN - 1);
+        }
+
+        /*
+        Attaches to the ring called name, or if capacity is non-zero, creates
+        it (or re-initializes it) empty. Returns 0, or an errno.
+        */
+        static int open(const char* name, uint64_t capacity, Ring** ring)
+        {
+            int fd = shm_open(name, O_RDWR | (capacity ? O_CREAT : 0), 0600);
+            struct stat st;
+            void* base;
+
+            if(fd < 0)
+                return errno;
+
+            if(capacity && ftruncate(fd, sizeof(RingHeader) + capacity) < 0) {
+                int err = errno;
+                close(fd);
+                return err;
+            }
+
+            if(fstat(fd, &st) < 0) {
+                int err = errno;
+                close(fd);
+                return err;
+            }
+
+            if((std::size_t) st.st_size < sizeof(RingHeader)) {
+                close(fd);
+                return EINVAL;
+            }
+
+            base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+            close(fd);
+
+            if(base == MAP_FAILED)
+                return errno;
+
+            RingHeader* hdr = (RingHeader*) base;
+
+            if(capacity) {
+                memset(hdr, 0, sizeof(*hdr));
+                memcpy(hdr->magic, "BCRR", 4);
+                hdr->version = VERSION;
+                hdr->capacity = capacity;
+            }
+
+            uint64_t cap = hdr->capacity;
+
+            if(memcmp(hdr->magic, "BCRR", 4) || hdr->version != VERSION || cap < ALIGN
+                    || (cap & (cap - 1)) || cap > st.st_size - sizeof(RingHeader)) {
+                munmap(base, st.st_size);
+                return EINVAL;
+            }
+
+            *ring = new Ring(base, st.st_size);
+
+            return 0;
+        }
+
+        /*
+        Producer side, appends a frame made of up to two parts. Returns false if
+        the ring is too full for it.
+        */
+        bool push(const void* a, std::size_t alen, const void* b = NULL, std::size_t blen = 0)
+        {
+            uint64_t need = frame_size(alen + blen);
+            uint64_t off = head & (capacity - 1);
+            uint64_t pad = capacity - off < need ? capacity - off : 0;
+
+            if(need > capacity)
+                return false;
+
+            if(head + pad + need - tail > capacity) {
+                tail = __atomic_load_n(&hdr->tail, __ATOMIC_ACQUIRE);
+                if(head + pad + need - tail > capacity)
+                    return false;
+            }
+
+            if(pad) {
+                uint32_t marker = PAD;
+                memcpy(data + off, &marker, 4);
+                off = 0;
+            }
+
+            uint32_t len = alen + blen;
+            memcpy(data + off, &len, 4);
+            memcpy(data + off + 4, a, alen);
+            if(blen)
+                memcpy(data + off + 4 + alen, b, blen);
+
+            head += pad + need;
+            __atomic_store_n(&hdr->head, head, __ATOMIC_RELEASE);
+
+            return true;
+        }
+
+        /*
+        Consumer side, returns the next frame, or NULL if the ring is empty, or
+        corrupt. The frame stays in place until it is released by advance().
+        */
+        const unsigned char* front(uint32_t* len)
+        {
+            corrupt = false;
+
+            for(;;) {
+                if(tail == head) {
+                    head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+                    if(tail == head)
+                        return NULL;
+                }
+
+                /* frames and padding must lie within what was published */
+                uint64_t avail = head - tail;
+                uint64_t off = tail & (capacity - 1);
+
+                if(avail > capacity || avail < 4) {
+                    corrupt = true;
+                    return NULL;
+                }
+
+                memcpy(len, data + off, 4);
+
+                if(*len != PAD) {
+                    if(*len > capacity - off - 4 || frame_size(*len) > avail) {
+                        corrupt = true;
+                        return NULL;
+                    }
+                    return data + off + 4;
+                }
+
+                if(capacity - off > avail) {
+                    corrupt = true;
+                    return NULL;
+                }
+                tail += capacity - off;
+            }
+        }
+
+        void pop(uint32_t len)
+        {
+            tail += frame_size(len);
+        }
+
+        /* Publishes the frames consumed with pop() back to the producer. */
+        void advance()
+        {
+            __atomic_store_n(&hdr->tail, tail, __ATOMIC_RELEASE);
+        }
+};
+
+/*
+Copy size bytes from src to dst, updating crc with them. The copy is done a
+block at a time, right after the block is checksummed, so the source is read
+from memory once, and then again from L1 cache. Large copies use
+non-temporal stores, so the destination doesn't evict the source, or anything
+else, from cache.
+*/
+static void crc_copy(Crc* crc, void* dst, const void* src, std::size_t size)
+{
+    static const std::size_t BLOCK = 4096;
+    static const std::size_t STREAM = 256 * 1024;
+    unsigned char* d = (unsigned char*) dst;
+    const unsigned char* s = (const unsigned char*) src;
+
+#ifdef __SSE2__
+    if(size >= STREAM) {
+        std::size_t head = (16 - ((uintptr_t) d & 15)) & 15;
+
+        crc->process_bytes(s, head);
+        memcpy(d, s, head);
+        d += head;
+        s += head;
+        size -= head;
+
+        while(size >= 16) {
+            std::size_t n = size < BLOCK ? size & ~(std::size_t) 15 : BLOCK;
+            crc->process_bytes(s, n);
+            for(std::size_t i = 0; i < n; i += 16) {
+                _mm_stream_si128((__m128i*) (d + i), _mm_loadu_si128((const __m128i*) (s + i)));
+            }
+            d += n;
+            s += n;
+            size -= n;
+        }
+
+        _mm_sfence();
+    }
+#endif
+
+    while(size > 0) {
+        std::size_t n = size < BLOCK ? size : BLOCK;
+        crc->process_bytes(s, n);
+        memcpy(d, s, n);
+        d += n;
+        s += n;
+        size -= n;
+    }
+}
+
+/*
+Run fn(ctx, begin, end) over [0, n), split into contiguous ranges across up to
+nthreads threads, the calling thread included.
+*/
+struct ParallelRange
+{
+    void (*fn)(void*, std::size_t, std::size_t);
+    void* ctx;
+    std::size_t begin;
+    std::size_t end;
+
+    static void* run(void* arg)
+    {
+        ParallelRange* r = (ParallelRange*) arg;
+        r->fn(r->ctx, r->begin, r->end);
+        return NULL;
+    }
+};
+
+static void parallel_for(std::size_t n, unsigned nthreads, void (*fn)(void*, std::size_t, std::size_t), void* ctx)
+{
+    if(nthreads > n)
+        nthreads = n ? n : 1;
+    if(nthreads < 1)
+        nthreads = 1;
+
+    std::vector<ParallelRange> ranges(nthreads);
+    std::vector<pthread_t> threads(nthreads);
+    std::vector<bool> started(nthreads);
+
+    for(unsigned i = 0; i < nthreads; i++) {
+        ranges[i].fn = fn;
+        ranges[i].ctx = ctx;
+        ranges[i].begin = n / nthreads * i + (i < n % nthreads ? i : n % nthreads);
+        ranges[i].end = ranges[i].begin + n / nthreads + (i < n % nthreads);
+    }
+
+    for(unsigned i = 1; i < nthreads; i++) {
+        started[i] = pthread_create(&threads[i], NULL, ParallelRange::run, &ranges[i]) == 0;
+    }
+
+    ParallelRange::run(&ranges[0]);
+
+    for(unsigned i = 1; i < nthreads; i++) {
+        if(started[i])
+            pthread_join(threads[i], NULL);
+        else
+            ParallelRange::run(&ranges[i]);
+    }
+}
+
+static unsigned online_cpus()
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? n : 1;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/*
+Fold the 16 byte blocks of a message for a crc without reflect_input, using
+carry-less multiplication. Returns in out 16 bytes with the same remainder
+modulo P as the blocks, so that checksumming out is equivalent to
+checksumming the blocks. k192 and k128 are x^192 and x^128 modulo P. The
+initial register of a crc, aligned to the top of 64 bits, is xored into the
+first 8 bytes, so the result is checksummed with an initial register of 0.
+*/
+__attribute__((target("pclmul,ssse3")))
+static void clmul_fold_msb(uint64_t k192, uint64_t k128, const unsigned char* p, std::size_t nblocks, unsigned char out[16],
+        uint64_t init = 0)
+{
+    const __m128i swap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    const __m128i k = _mm_set_epi64x(k192, k128);
+    __m128i a = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) p), swap);
+
+    a = _mm_xor_si128(a, _mm_set_epi64x(init, 0));
+
+    for(std::size_t i = 1; i < nblocks; i++) {
+        __m128i b = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (p + 16 * i)), swap);
+        __m128i hi = _mm_clmulepi64_si128(a, k, 0x11);
+        __m128i lo = _mm_clmulepi64_si128(a, k, 0x00);
+        a = _mm_xor_si128(_mm_xor_si128(hi, lo), b);
+    }
+
+    _mm_storeu_si128((__m128i*) out, _mm_shuffle_epi8(a, swap));
+}
+
+static bool have_clmul()
+{
+    static const bool have = __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("ssse3");
+    return have;
+}
+#else
+static void clmul_fold_msb(uint64_t, uint64_t, const unsigned char*, std::size_t, unsigned char*, uint64_t = 0)
+{
+}
+
+static bool have_clmul()
+{
+    return false;
+}
+#endif
+
+/*
+CRC-16/T10-DIF, the guard tag of SCSI protection information, folded with
+carry-less multiplication when the CPU supports it, otherwise table driven.
+*/
+class T10Dif
+{
+    private:
+
+        uint64_t k192_;
+        uint64_t k128_;
+        bool clmul_;
+
+    public:
+
+        typedef boost::crc_optimal<16, 0x8BB7, 0, 0, false, false> crc_type;
+
+        T10Dif() : clmul_(have_clmul())
+        {
+            Gf2 g(crc_params(crc_type()));
+            k192_ = g.xpow(192);
+            k128_ = g.xpow(128);
+        }
+
+        uint16_t operator()(const unsigned char* p, std::size_t n) const
+        {
+            crc_type crc;
+
+            if(clmul_ && n >= 16) {
+                unsigned char folded[16];
+                clmul_fold_msb(k192_, k128_, p, n / 16, folded);
+                crc.process_bytes(folded, 16);
+                p += n & ~(std::size_t) 15;
+                n &= 15;
+            }
+
+            crc.process_bytes(p, n);
+
+            return crc.checksum();
+        }
+};
+
+/*
+CRC-32/MPEG-2, of the sections of MPEG transport streams, folded with
+carry-less multiplication when the CPU supports it, otherwise table driven.
+*/
+class Mpeg2Crc
+{
+    private:
+
+        typedef boost::crc_optimal<32, 0x04C11DB7, 0, 0, false, false> folded_type;
+
+        uint64_t k192_;
+        uint64_t k128_;
+        bool clmul_;
+
+    public:
+
+        typedef boost::crc_optimal<32, 0x04C11DB7, 0xFFFFFFFF, 0, false, false> crc_type;
+
+        Mpeg2Crc() : clmul_(have_clmul())
+        {
+            Gf2 g(crc_params(crc_type()));
+            k192_ = g.xpow(192);
+            k128_ = g.xpow(128);
+        }
+
+        uint32_t operator()(const unsigned char* p, std::size_t n) const
+        {
+            if(clmul_ && n >= 16) {
+                unsigned char folded[16];
+                folded_type crc;
+                clmul_fold_msb(k192_, k128_, p, n / 16, folded, (uint64_t) 0xFFFFFFFF << 32);
+                crc.process_bytes(folded, 16);
+                crc.process_bytes(p + (n & ~(std::size_t) 15), n & 15);
+                return crc.checksum();
+            }
+
+            crc_type crc;
+            crc.process_bytes(p, n);
+            return crc.checksum();
+        }
+};
+
+/*
+CRC-32 of a window of the last n bytes of a stream, updated as each byte
+enters (and one leaves) the window. The crc has no initial or final xor value,
+so it is linear in the window's bytes, and the contribution of the byte
+leaving the window can be xored out.
+*/
+class RollingCrc
+{
+    private:
+
+        uint32_t table_[256];
+        uint32_t out_[256];
+
+        uint32_t step(uint32_t crc, unsigned char in) const
+        {
+            return (crc >> 8) ^ table_[(crc ^ in) & 0xFF];
+        }
+
+    public:
+
+        std::size_t window;
+        uint32_t crc;
+
+        explicit RollingCrc(std::size_t window_) : window(window_), crc(0)
+        {
+            for(unsigned b = 0; b < 256; b++) {
+                uint32_t r = b;
+                for(int k = 0; k < 8; k++) {
+                    r = (r >> 1) ^ (r & 1 ? 0xEDB88320 : 0);
+                }
+                table_[b] = r;
+            }
+
+            /* out_[b] is the crc of b followed by window zeros, linear in b */
+            out_[0] = 0;
+            for(unsigned bit = 1; bit < 256; bit <<= 1) {
+                uint32_t r = step(0, bit);
+                for(std::size_t i = 0; i < window; i++) {
+                    r = step(r, 0);
+                }
+                out_[bit] = r;
+            }
+            for(unsigned b = 1; b < 256; b++) {
+                out_[b] = out_[b & (b - 1)] ^ out_[b & -b];
+            }
+        }
+
+        /* The crc of the window of bytes at p. */
+        uint32_t of(const unsigned char* p) const
+        {
+            uint32_t r = 0;
+            for(std::size_t i = 0; i < window; i++) {
+                r = step(r, p[i]);
+            }
+            return r;
+        }
+
+        /* Restart with the window over the bytes at p. */
+        uint32_t reset(const unsigned char* p)
+        {
+            crc = of(p);
+            return crc;
+        }
+
+        uint32_t roll(unsigned char out, unsigned char in)
+        {
+            crc = step(crc, in) ^ out_[out];
+            return crc;
+        }
+};
+
+/*
+Block matching of a new file against the blocks of an old one, rsync style.
+*/
+struct DeltaJob
+{
+    struct Match
+    {
+        std::size_t at;
+        std::size_t block;
+    };
+
+    const unsigned char* old;
+    const unsigned char* new_;
+    std::size_t newsize;
+    std::size_t bs;
+    std::size_t nregions;
+    RollingCrc* roller;
+
+    /* hash table of old blocks by crc, chained through next */
+    std::vector<uint32_t> crcs;
+    std::vector<std::size_t> heads;
+    std::vector<std::size_t> next;
+    std::size_t mask;
+
+    enum { NONE = (std::size_t) -1 };
+
+    std::vector< std::vector<Match> > matches;
+
+    /* copies of length bytes from old offset to at in new, literals between them */
+    struct Copy
+    {
+        std::size_t at;
+        std::size_t offset;
+        std::size_t length;
+    };
+
+    std::vector<Copy> copies;
+
+    void index(std::size_t nblocks)
+    {
+        std::size_t size = 1;
+
+        while(size < 2 * nblocks)
+            size <<= 1;
+
+        mask = size - 1;
+        crcs.resize(nblocks);
+        heads.assign(size, NONE);
+        next.resize(nblocks);
+
+        /* chain in reverse, so each chain is in block order */
+        for(std::size_t b = nblocks; b-- > 0; ) {
+            crcs[b] = roller->of(old + b * bs);
+            next[b] = heads[crcs[b] & mask];
+            heads[crcs[b] & mask] = b;
+        }
+    }
+
+    /*
+    Returns the block matching the bytes at p, preferring the hint, the block
+    after the previous match, so runs of matches coalesce into one copy.
+    */
+    std::size_t lookup(uint32_t crc, const unsigned char* p, std::size_t hint) const
+    {
+        if(hint < crcs.size() && crcs[hint] == crc && memcmp(old + hint * bs, p, bs) == 0)
+            return hint;
+        for(std::size_t b = heads[crc & mask]; b != NONE; b = next[b]) {
+            if(crcs[b] == crc && memcmp(old + b * bs, p, bs) == 0)
+                return b;
+        }
+        return NONE;
+    }
+
+    std::size_t regsize() const
+    {
+        return nregions ? (newsize + nregions - 1) / nregions : 0;
+    }
+
+    /* The end of the positions where matches starting in a region may be. */
+    std::size_t stop(std::size_t region) const
+    {
+        std::size_t stop = (region + 1) * regsize();
+
+        return stop < newsize - bs + 1 ? stop : newsize - bs + 1;
+    }
+
+    /* Find matches starting in each region, the windows may run past its end. */
+    static void scan(void* ctx, std::size_t begin, std::size_t end)
+    {
+        DeltaJob* job = (DeltaJob*) ctx;
+        std::size_t regsize = job->regsize();
+
+        for(std::size_t region = begin; region < end; region++) {
+            std::size_t at = region * regsize;
+            std::size_t stop = job->stop(region);
+            RollingCrc r(*job->roller);
+            bool primed = false;
+            std::size_t hint = NONE;
+
+            while(at < stop) {
+                const unsigned char* p = job->new_ + at;
+                uint32_t crc = primed ? r.roll(p[-1], p[job->bs - 1]) : r.reset(p);
+                std::size_t b = job->lookup(crc, p, hint);
+
+                primed = b == NONE;
+                hint = b == NONE ? NONE : b + 1;
+
+                if(b == NONE) {
+                    at++;
+                } else {
+                    Match m = { at, b };
+                    job->matches[region].push_back(m);
+                    at += job->bs;
+                }
+            }
+        }
+    }
+
+    /* Append a match to the copies, coalescing it with the previous copy. */
+    void add(std::size_t at, std::size_t block)
+    {
+        if(!copies.empty()) {
+            Copy& c = copies.back();
+            std::size_t follows = (c.offset + c.length) / bs;
+
+            /* of duplicate blocks, prefer the one continuing the copy */
+            if(c.at + c.length == at && (c.offset + c.length) % bs == 0
+                    && lookup(crcs[block], new_ + at, follows) == follows)
+                block = follows;
+
+            if(c.at + c.length == at && c.offset + c.length == block * bs) {
+                c.length += bs;
+                return;
+            }
+        }
+
+        Copy c = { at, block * bs, bs };
+        copies.push_back(c);
+    }
+
+    /*
+    Join the matches of the regions. Each region was scanned from its start,
+    which may not be where the scan of the previous region left off, so new is
+    scanned again from there until it reaches a position the region's scan
+    also visited, one not inside one of its matches. From there on the scans
+    agree, whichever block they chose, and past the region's last match its
+    scan found none up to its stop, so the next region picks up from there.
+    */
+    void merge()
+    {
+        std::size_t regsize = this->regsize();
+        std::size_t pos = 0;
+        RollingCrc r(*roller);
+
+        for(std::size_t region = 0; region < nregions; region++) {
+            const std::vector<Match>& list = matches[region];
+            std::size_t i = 0;
+            bool primed = false;
+
+            for(;;) {
+                if(pos >= region * regsize) {
+                    while(i < list.size() && list[i].at + bs <= pos)
+                        i++;
+                    if(i == list.size() || list[i].at >= pos)
+                        break;
+                }
+
+                if(pos + bs > newsize)
+                    break;
+
+                const unsigned char* p = new_ + pos;
+                uint32_t crc = primed ? r.roll(p[-1], p[bs - 1]) : r.reset(p);
+                std::size_t b = lookup(crc, p, NONE);
+
+                primed = b == NONE;
+                if(b == NONE) {
+                    pos++;
+                } else {
+                    add(pos, b);
+                    pos += bs;
+                }
+            }
+
+            for(; i < list.size(); i++) {
+                add(list[i].at, list[i].block);
+                pos = list[i].at + bs;
+            }
+            if(pos < stop(region))
+                pos = stop(region);
+        }
+    }
+};
+
+/*
+Content defined chunking: a stream is cut where the rolling crc of the last
+window bytes has its low bits zero, so cuts depend only on nearby content,
+and survive insertions and deletions elsewhere. Chunks are at least min and
+at most max bytes, and each has a fingerprint, a crc of its bytes.
+
+Large inputs are scanned for candidate cuts in parallel regions, since the
+rolling crc at a position depends only on the window before it, then the
+cuts are chosen from the candidates in order, and the chunks fingerprinted
+in parallel.
+*/
+class Chunker
+{
+    private:
+
+        struct Region
+        {
+            Chunker* chunker;
+            const unsigned char* data;
+            std::size_t begin;
+            std::size_t end;
+            /* candidates, positions after which the rolling crc matches */
+            std::vector<std::size_t> candidates;
+            uint32_t roll;
+        };
+
+        struct Segment
+        {
+            std::size_t begin;
+            std::size_t end;
+            uint64_t reg;
+        };
+
+        struct Job
+        {
+            Chunker* chunker;
+            const unsigned char* data;
+            std::vector<Region> regions;
+            std::vector<Segment> segments;
+        };
+
+        RollingCrc roller_;
+        CrcTable fingerprint_;
+        /* the last window bytes of the stream, oldest first */
+        std::vector<unsigned char> tail_;
+        uint32_t roll_;
+        /* fingerprint register of the chunk so far */
+        uint64_t reg_;
+        /* offset in the stream of the start of the current chunk, and of the end */
+        uint64_t start_;
+        uint64_t offset_;
+
+        static void scan(void* ctx, std::size_t begin, std::size_t end)
+        {
+            Job* job = (Job*) ctx;
+
+            for(std::size_t i = begin; i < end; i++) {
+                job->chunker->scan(job->regions[i]);
+            }
+        }
+
+        void scan(Region& r) const
+        {
+            std::size_t window = roller_.window;
+            RollingCrc roller(roller_);
+            const unsigned char* data = r.data;
+
+            roller.crc = r.begin ? roller.of(data + r.begin - window) : roll_;
+
+            for(std::size_t p = r.begin; p < r.end; p++) {
+                unsigned char out = p >= window ? data[p - window] : tail_[p];
+                if((roller.roll(out, data[p]) & mask) == 0)
+                    r.candidates.push_back(p);
+            }
+
+            r.roll = roller.crc;
+        }
+
+        static void fingerprint(void* ctx, std::size_t begin, std::size_t end)
+        {
+            Job* job = (Job*) ctx;
+
+            for(std::size_t i = begin; i < end; i++) {
+                Segment& s = job->segments[i];
+                s.reg = job->chunker->fingerprint_.process(s.reg, job->data + s.begin, s.end - s.begin);
+            }
+        }
+
+        void cut(uint64_t at, std::vector<uint64_t>* cuts)
+        {
+            cuts->push_back(at);
+            start_ = at;
+        }
+
+    public:
+
+        std::size_t min;
+        std::size_t max;
+        uint32_t mask;
+        unsigned threads;
+
+        Chunker(std::size_t window, std::size_t min_, std::size_t max_, uint32_t mask_,
+                const CrcParams& p, unsigned threads_)
+            : roller_(window), fingerprint_(p), tail_(window), roll_(0),
+              reg_(fingerprint_.init), start_(0), offset_(0),
+              min(min_), max(max_), mask(mask_), threads(threads_)
+        {
+        }
+
+        const CrcTable& fingerprint() const
+        {
+            return fingerprint_;
+        }
+
+        /*
+        Append bytes to the stream. The ends of the chunks completed are
+        appended to cuts, and their fingerprints to fingerprints.
+        */
+        void feed(const unsigned char* data, std::size_t n,
+                std::vector<uint64_t>* cuts, std::vector<uint64_t>* fingerprints)
+        {
+            std::size_t window = roller_.window;
+            Job job;
+            std::size_t nregions = 1;
+
+            /* regions of at least 256K, the first starts with the stream's window */
+            if(threads > 1 && n >= 2 * 256 * 1024) {
+                nregions = std::min<std::size_t>(n / (256 * 1024), 4 * threads);
+            }
+
+            job.chunker = this;
+            job.data = data;
+            job.regions.resize(nregions);
+            for(std::size_t i = 0; i < nregions; i++) {
+                job.regions[i].data = data;
+                job.regions[i].begin = n / nregions * i;
+                job.regions[i].end = i + 1 == nregions ? n : n / nregions * (i + 1);
+            }
+
+            parallel_for(nregions, threads, scan, &job);
+
+            std::size_t first = cuts->size();
+
+            for(std::size_t i = 0; i < nregions; i++) {
+                const std::vector<std::size_t>& c = job.regions[i].candidates;
+                for(std::size_t k = 0; k < c.size(); k++) {
+                    uint64_t end = offset_ + c[k] + 1;
+                    while(end - start_ > max)
+                        cut(start_ + max, cuts);
+                    if(end - start_ >= min)
+                        cut(end, cuts);
+                }
+            }
+            while(offset_ + n - start_ >= max)
+                cut(start_ + max, cuts);
+
+            /* fingerprint the pieces of the chunks in this feed */
+            std::size_t at = 0;
+            for(std::size_t i = first; i <= cuts->size(); i++) {
+                Segment s;
+                s.begin = at;
+                s.end = i < cuts->size() ? (*cuts)[i] - offset_ : n;
+                s.reg = i == first ? reg_ : fingerprint_.init;
+                job.segments.push_back(s);
+                at = s.end;
+            }
+
+            parallel_for(job.segments.size(), nregions > 1 ? threads : 1, fingerprint, &job);
+
+            for(std::size_t i = 0; i + 1 < job.segments.size(); i++) {
+                fingerprints->push_back(fingerprint_.checksum(job.segments[i].reg));
+            }
+            reg_ = job.segments.back().reg;
+
+            roll_ = job.regions.back().roll;
+            if(n >= window) {
+                memcpy(&tail_[0], data + n - window, window);
+            } else {
+                memmove(&tail_[0], &tail_[n], window - n);
+                memcpy(&tail_[window - n], data, n);
+            }
+            offset_ += n;
+        }
+
+        /* End the stream, cutting the last chunk if it isn't empty, and start a new one. */
+        void finish(std::vector<uint64_t>* cuts, std::vector<uint64_t>* fingerprints)
+        {
+            if(offset_ > start_) {
+                cuts->push_back(offset_);
+                fingerprints->push_back(fingerprint_.checksum(reg_));
+            }
+            std::fill(tail_.begin(), tail_.end(), 0);
+            roll_ = 0;
+            reg_ = fingerprint_.init;
+            start_ = 0;
+            offset_ = 0;
+        }
+};
+
+/*
+Writes packets to a pcap file, filling in their checksums: an application
+crc at the end of the UDP or TCP payload, the UDP or TCP checksum and IPv4
+header checksum, and the Ethernet FCS. Records are written through a large
+buffer.
+*/
+class PcapWriter
+{
+    private:
+
+        int fd_;
+        std::vector<unsigned char> buf_;
+        std::size_t used_;
+        CrcOptimal<boost::crc_32_type> fcs_;
+
+        static const std::size_t BUFSIZE = 4 << 20;
+
+        static uint16_t get16(const unsigned char* p)
+        {
+            return p[0] << 8 | p[1];
+        }
+
+        static void put16(unsigned char* p, uint16_t v)
+        {
+            p[0] = v >> 8;
+            p[1] = v;
+        }
+
+        /* ones' complement sum of bytes, not yet folded */
+        static uint32_t sum(const unsigned char* p, std::size_t n, uint32_t s = 0)
+        {
+            for(; n > 1; n -= 2, p += 2) {
+                s += p[0] << 8 | p[1];
+            }
+            if(n)
+                s += p[0] << 8;
+            return s;
+        }
+
+        static uint16_t fold(uint32_t s)
+        {
+            while(s >> 16)
+                s = (s & 0xFFFF) + (s >> 16);
+            return ~s;
+        }
+
+        void append(const void* p, std::size_t n)
+        {
+            if(!error && used_ + n > buf_.size())
+                error = flush();
+            if(error)
+                return;
+            if(n > buf_.size()) {
+                if(write(p, n) < 0)
+                    error = errno;
+                return;
+            }
+            memcpy(&buf_[used_], p, n);
+            used_ += n;
+        }
+
+        ssize_t write(const void* p, std::size_t n)
+        {
+            for(std::size_t done = 0; done < n; ) {
+                ssize_t w = ::write(fd_, (const char*) p + done, n - done);
+                if(w < 0 && errno == EINTR)
+                    continue;
+                if(w < 0)
+                    return -1;
+                done += w;
+            }
+            return n;
+        }
+
+    public:
+
+        uint32_t linktype;
+        uint32_t snaplen;
+        bool nano;
+        bool fcs;
+        bool checksums;
+        /* application crc, and where it is in the payload */
+        Crc* app;
+        FrameCrc appframe;
+        /* timestamps in ns: of the first packet, and between packets */
+        uint64_t start;
+        uint64_t interval;
+        uint64_t count;
+        /* errno of the first failed write, or 0 */
+        int error;
+        /* the frame being written */
+        std::vector<unsigned char> scratch;
+
+        PcapWriter(int fd) : fd_(fd), buf_(BUFSIZE), used_(0), app(NULL), count(0), error(0)
+        {
+        }
+
+        ~PcapWriter()
+        {
+            close();
+            delete app;
+        }
+
+        /* Returns 0, or an errno. */
+        int header()
+        {
+            struct {
+                uint32_t magic;
+                uint16_t major;
+                uint16_t minor;
+                int32_t thiszone;
+                uint32_t sigfigs;
+                uint32_t snaplen;
+                uint32_t linktype;
+            } h = { nano ? 0xA1B23C4D : 0xA1B2C3D4, 2, 4, 0, 0, snaplen, linktype };
+
+            append(&h, sizeof(h));
+            return error;
+        }
+
+        /* Returns 0, or an errno. */
+        int flush()
+        {
+            int err = 0;
+            if(used_ && fd_ >= 0 && write(&buf_[0], used_) < 0)
+                err = errno;
+            used_ = 0;
+            return err;
+        }
+
+        int close()
+        {
+            int err = error ? error : flush();
+
+            if(fd_ >= 0 && ::close(fd_) < 0 && !err)
+                err = errno;
+            fd_ = -1;
+            return err;
+        }
+
+        /* Fill in the checksums of the IPv4 packet at ip, of at most n bytes. */
+        void ipv4(unsigned char* ip, std::size_t n)
+        {
+            std::size_t ihl = (ip[0] & 0xF) * 4;
+            std::size_t total = get16(ip + 2);
+
+            if((ip[0] >> 4) != 4 || ihl < 20 || total < ihl || total > n)
+                return;
+
+            unsigned char proto = ip[9];
+            unsigned char* l4 = ip + ihl;
+            std::size_t l4len = total - ihl;
+            std::size_t hdr = proto == 17 ? 8 : proto == 6 && l4len >= 20 ? (l4[12] >> 4) * 4 : 0;
+            bool fragment = (get16(ip + 6) & 0x3FFF) != 0;
+
+            if(!fragment && hdr && hdr <= l4len) {
+                if(app && l4len - hdr >= appframe.size) {
+                    unsigned char* payload = l4 + hdr;
+                    std::size_t len = l4len - hdr - appframe.size;
+                    app->reset();
+                    app->process_bytes(appframe.payload(payload), len);
+                    appframe.put((unsigned char*) appframe.at(payload, len + appframe.size), app->checksum());
+                }
+
+                if(checksums) {
+                    unsigned char* field = l4 + (proto == 17 ? 6 : 16);
+                    uint32_t s = sum(ip + 12, 8, proto + l4len);
+                    put16(field, 0);
+                    uint16_t c = fold(sum(l4, l4len, s));
+                    put16(field, proto == 17 && c == 0 ? 0xFFFF : c);
+                }
+            }
+
+            if(checksums) {
+                put16(ip + 10, 0);
+                put16(ip + 10, fold(sum(ip, ihl)));
+            }
+        }
+
+        /* Fill in the checksums of the frame, and write it, with time in ns, or -1. */
+        void packet(unsigned char* frame, std::size_t n, int64_t time)
+        {
+            std::size_t l3 = (std::size_t) -1;
+
+            if(linktype == 1 && n >= 14) {
+                l3 = 12;
+                while(l3 + 6 <= n && (get16(frame + l3) == 0x8100 || get16(frame + l3) == 0x88A8))
+                    l3 += 4;
+                l3 = get16(frame + l3) == 0x0800 ? l3 + 2 : (std::size_t) -1;
+            } else if(linktype == 101 || linktype == 228) {
+                l3 = 0;
+            }
+
+            if(l3 + 20 <= n)
+                ipv4(frame + l3, n - l3);
+
+            unsigned char tail[4];
+            std::size_t len = n;
+
+            if(fcs && linktype == 1) {
+                FrameCrc f = { 4, true, false };
+                fcs_.reset();
+                fcs_.process_bytes(frame, n);
+                f.put(tail, fcs_.checksum());
+                len += 4;
+            }
+
+            uint64_t ts = time >= 0 ? time : start + count * interval;
+            uint32_t incl = len < snaplen ? len : snaplen;
+            uint32_t rec[4] = {
+                (uint32_t) (ts / 1000000000), (uint32_t) (ts % 1000000000 / (nano ? 1 : 1000)),
+                incl, (uint32_t) len
+            };
+
+            append(rec, sizeof(rec));
+            append(frame, std::min<std::size_t>(n, incl));
+            if(incl > n)
+                append(tail, incl - n);
+
+            count++;
+        }
+};
+
+/*
+xoshiro256**, a fast generator of random 64 bit numbers, by Blackman and
+Vigna, seeded with splitmix64.
+*/
+class Xoshiro
+{
+    private:
+
+        uint64_t s_[4];
+
+        static uint64_t rotl(uint64_t x, int k)
+        {
+            return (x << k) | (x >> (64 - k));
+        }
+
+    public:
+
+        explicit Xoshiro(uint64_t seed)
+        {
+            for(int i = 0; i < 4; i++) {
+                uint64_t z = (seed += 0x9E3779B97F4A7C15ULL);
+                z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+                z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+                s_[i] = z ^ (z >> 31);
+            }
+        }
+
+        uint64_t next()
+        {
+            uint64_t r = rotl(s_[1] * 5, 7) * 9;
+            uint64_t t = s_[1] << 17;
+
+            s_[2] ^= s_[0];
+            s_[3] ^= s_[1];
+            s_[1] ^= s_[2];
+            s_[0] ^= s_[3];
+            s_[2] ^= t;
+            s_[3] = rotl(s_[3], 45);
+
+            return r;
+        }
+
+        /* uniform in (0, 1] */
+        double uniform()
+        {
+            return ((next() >> 11) + 1) * (1.0 / 9007199254740992.0);
+        }
+
+        /* uniform in [0, n) */
+        uint64_t below(uint64_t n)
+        {
+            return (uint64_t) ((next() >> 11) * (1.0 / 9007199254740992.0) * n);
+        }
+};
+
+/*
+Monte Carlo estimate of the rate of errors a crc doesn't detect. A crc is
+linear, so an error goes undetected exactly when the crc of the error
+pattern alone, over the codeword of message and crc, is zero, whatever the
+message. That crc is the xor of x^d mod P for each bit in error, d bits from
+the end of the codeword, so a trial costs only as much as its errors.
+
+With random bit errors, the gaps between errors are geometrically
+distributed, so the trials are treated as one stream of bits, and error free
+stretches of it are skipped over. Trials are split into blocks, each with
+its own generator, so the result for a seed doesn't depend on the threads.
+*/
+struct Simulation
+{
+    static const uint64_t BLOCK = 1 << 16;
+
+    /* x^d mod P, for each bit of the codeword */
+    std::vector<uint64_t> syndromes;
+    uint64_t bits;
+    uint64_t trials;
+    double ber;
+    uint64_t burst;
+    uint64_t seed;
+    /* trials with errors, and those with errors that weren't detected */
+    uint64_t errored;
+    uint64_t undetected;
+
+    Simulation(const Gf2& gf2, std::size_t len)
+        : syndromes(len * 8 + gf2.bits), bits(syndromes.size()), trials(0), ber(0), burst(0),
+          seed(0), errored(0), undetected(0)
+    {
+        uint64_t x = 1;
+        for(std::size_t d = 0; d < syndromes.size(); d++, x = gf2.mulx(x)) {
+            syndromes[d] = x;
+        }
+    }
+
+    static void run(void* ctx, std::size_t begin, std::size_t end)
+    {
+        Simulation* sim = (Simulation*) ctx;
+
+        for(std::size_t b = begin; b < end; b++) {
+            uint64_t count = std::min(BLOCK, sim->trials - b * BLOCK);
+            uint64_t errored = 0;
+            uint64_t undetected = 0;
+            Xoshiro rng(sim->seed ^ (b * 0xD1342543DE82EF95ULL));
+
+            if(sim->burst)
+                sim->bursts(rng, count, &errored, &undetected);
+            else
+                sim->random(rng, count, &errored, &undetected);
+
+            __sync_fetch_and_add(&sim->errored, errored);
+            __sync_fetch_and_add(&sim->undetected, undetected);
+        }
+    }
+
+    void random(Xoshiro& rng, uint64_t count, uint64_t* errored, uint64_t* undetected) const
+    {
+        double total = (double) count * bits;
+        double log1mp = log1p(-ber);
+        uint64_t trial = (uint64_t) -1;
+        uint64_t syndrome = 0;
+
+        if(ber <= 0)
+            return;
+
+        for(double pos = 0; ; pos++) {
+            /* skip the bits without errors */
+            if(ber < 1)
+                pos += floor(log(rng.uniform()) / log1mp);
+            if(pos >= total)
+                break;
+
+            uint64_t p = (uint64_t) pos;
+            uint64_t t = p / bits;
+
+            if(t != trial) {
+                if(trial != (uint64_t) -1) {
+                    (*errored)++;
+                    *undetected += syndrome == 0;
+                }
+                trial = t;
+                syndrome = 0;
+            }
+            syndrome ^= syndromes[p % bits];
+        }
+
+        if(trial != (uint64_t) -1) {
+            (*errored)++;
+            *undetected += syndrome == 0;
+        }
+    }
+
+    /* A burst flips its first and last bits, and each between them at random. */
+    void bursts(Xoshiro& rng, uint64_t count, uint64_t* errored, uint64_t* undetected) const
+    {
+        for(uint64_t i = 0; i < count; i++) {
+            uint64_t at = rng.below(bits - burst + 1);
+            uint64_t syndrome = syndromes[at] ^ (burst > 1 ? syndromes[at + burst - 1] : 0);
+
+            for(uint64_t k = 1; k + 1 < burst; k += 64) {
+                uint64_t r = rng.next();
+                for(uint64_t j = k; j < k + 64 && j + 1 < burst; j++, r >>= 1) {
+                    if(r & 1)
+                        syndrome ^= syndromes[at + j];
+                }
+            }
+
+            (*errored)++;
+            *undetected += syndrome == 0;
+        }
+    }
+};
+
+/*
+Array of unsigned integers of 16, 32 or 64 bits, packed in native byte order,
+for holding many checksums in a fraction of the memory of a Lua table. The
+searches assume the array is sorted.
+*/
+class CrcArray
+{
+    private:
+
+        std::vector<unsigned char> bytes_;
+
+        template < class T >
+        static void sort_as(unsigned char* p, std::size_t n)
+        {
+            std::sort((T*) p, (T*) p + n);
+        }
+
+    public:
+
+        const unsigned width;
+        bool sorted;
+
+        CrcArray(unsigned bits, std::size_t n) : bytes_(n * (bits / 8)), width(bits / 8), sorted(n < 2)
+        {
+        }
+
+        std::size_t size() const
+        {
+            return bytes_.size() / width;
+        }
+
+        uint64_t max() const
+        {
+            return width == 8 ? ~(uint64_t) 0 : ((uint64_t) 1 << (width * 8)) - 1;
+        }
+
+        uint64_t get(std::size_t i) const
+        {
+            const unsigned char* p = &bytes_[i * width];
+            switch(width) {
+                case 2: return *(const uint16_t*) p;
+                case 4: return *(const uint32_t*) p;
+                default: return *(const uint64_t*) p;
+            }
+        }
+
+        void set(std::size_t i, uint64_t v)
+        {
+            unsigned char* p = &bytes_[i * width];
+            switch(width) {
+                case 2: *(uint16_t*) p = v; break;
+                case 4: *(uint32_t*) p = v; break;
+                default: *(uint64_t*) p = v; break;
+            }
+            sorted = false;
+        }
+
+        void push(uint64_t v)
+        {
+            bytes_.resize(bytes_.size() + width);
+            set(size() - 1, v);
+        }
+
+        void reserve(std::size_t n)
+        {
+            bytes_.reserve(n * width);
+        }
+
+        void sort()
+        {
+            if(sorted)
+                return;
+            switch(width) {
+                case 2: sort_as<uint16_t>(&bytes_[0], size()); break;
+                case 4: sort_as<uint32_t>(&bytes_[0], size()); break;
+                default: sort_as<uint64_t>(&bytes_[0], size()); break;
+            }
+            sorted = true;
+        }
+
+        /* Index of the first v, or size() if there is none. */
+        std::size_t search(uint64_t v) const
+        {
+            std::size_t lo = 0;
+            std::size_t hi = size();
+
+            while(lo < hi) {
+                std::size_t mid = lo + (hi - lo) / 2;
+                if(get(mid) < v)
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+
+            return lo < size() && get(lo) == v ? lo : size();
+        }
+
+        /* Count of values equal to the one before them. */
+        std::size_t duplicates() const
+        {
+            std::size_t n = 0;
+            for(std::size_t i = 1; i < size(); i++) {
+                n += get(i) == get(i - 1);
+            }
+            return n;
+        }
+
+        /* Appends to out each value in both this and other, once. */
+        void intersect(const CrcArray& other, CrcArray* out) const
+        {
+            std::size_t i = 0;
+            std::size_t j = 0;
+
+            while(i < size() && j < other.size()) {
+                uint64_t a = get(i);
+                uint64_t b = other.get(j);
+                if(a < b) {
+                    i++;
+                } else if(b < a) {
+                    j++;
+                } else {
+                    out->push(a);
+                    while(i < size() && get(i) == a) i++;
+                    while(j < other.size() && other.get(j) == a) j++;
+                }
+            }
+            out->sorted = true;
+        }
+};
+
+/*
+Append-only journal of records, each a u32le length, the record, and a crc
+of both, as read by bcrc.records() with cover_length=true. Appends are
+buffered, and written and synced together as a group.
+*/
+class Journal
+{
+    private:
+
+        int fd_;
+        std::string path_;
+        std::vector<unsigned char> buf_;
+        Crc* crc_;
+
+        struct Scan
+        {
+            const unsigned char* data;
+            const std::vector<uint64_t>* starts;
+            const RecordFormat* format;
+            const Crc* crc;
+            /* index of the first record that doesn't verify */
+            std::size_t bad;
+        };
+
+        static void verify(void* ctx, std::size_t begin, std::size_t end)
+        {
+            Scan* scan = (Scan*) ctx;
+            const std::vector<uint64_t>& starts = *scan->starts;
+            Crc* crc = scan->crc->clone();
+
+            for(std::size_t i = begin; i < end && i < __atomic_load_n(&scan->bad, __ATOMIC_RELAXED); i++) {
+                uintmax_t sum;
+                if(!scan->format->check(crc, scan->data + starts[i], starts[i + 1] - starts[i], &sum)) {
+                    std::size_t bad = __atomic_load_n(&scan->bad, __ATOMIC_RELAXED);
+                    while(i < bad && !__atomic_compare_exchange_n(&scan->bad, &bad, i, false,
+                                __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                        ;
+                    break;
+                }
+            }
+
+            delete crc;
+        }
+
+    public:
+
+        RecordFormat format;
+        /* bytes of appends buffered before they are committed */
+        std::size_t group;
+        bool sync;
+        unsigned threads;
+        /* bytes in the file */
+        uint64_t size;
+
+        Journal(int fd, const char* path, const Crc* crc)
+            : fd_(fd), path_(path), crc_(crc->clone()), group(0), sync(true), threads(1), size(0)
+        {
+            format.lenbytes = 4;
+            format.lenlittle = true;
+            format.header = 0;
+            format.crc_at = RecordFormat::CRC_TAIL;
+            format.cover_length = true;
+        }
+
+        ~Journal()
+        {
+            close();
+            delete crc_;
+        }
+
+        /* Returns 0, or an errno. */
+        int append(const void* p, std::size_t n)
+        {
+            std::size_t at = buf_.size();
+
+            buf_.resize(at + format.lenbytes + n + format.frame.size);
+
+            unsigned char* r = &buf_[at];
+
+            for(std::size_t i = 0; i < format.lenbytes; i++) {
+                r[i] = (unsigned char) (n >> (8 * i));
+            }
+            memcpy(r + format.lenbytes, p, n);
+            crc_->reset();
+            crc_->process_bytes(r, format.lenbytes + n);
+            format.frame.put(r + format.lenbytes + n, crc_->checksum());
+
+            return buf_.size() >= group ? commit() : 0;
+        }
+
+        /* Write the buffered records, and sync them. Returns 0, or an errno. */
+        int commit()
+        {
+            for(std::size_t done = 0; done < buf_.size(); ) {
+                ssize_t w = ::write(fd_, &buf_[done], buf_.size() - done);
+                if(w < 0 && errno == EINTR)
+                    continue;
+                if(w < 0) {
+                    /* keep only what is left to write, for a retry */
+                    int err = errno;
+                    buf_.erase(buf_.begin(), buf_.begin() + done);
+                    return err;
+                }
+                done += w;
+                size += w;
+            }
+            buf_.clear();
+
+            if(sync && fdatasync(fd_) < 0)
+                return errno;
+
+            return 0;
+        }
+
+        /*
+        Scan the file for the records whose crcs verify, up to the first that
+        doesn't, and cut the file there. The record boundaries are found by
+        following the lengths, and the records verified in parallel. Their
+        starts are returned in starts, followed by the tail. Returns 0, or an
+        errno.
+        */
+        int recover(Mapping* m, std::vector<uint64_t>* starts)
+        {
+            if(int err = commit())
+                return err;
+            if(int err = m->map(path_.c_str()))
+                return err;
+
+            uint64_t pos = 0;
+
+            starts->clear();
+            for(std::size_t n; (n = format.next(m->data + pos, m->size - pos)); pos += n) {
+                starts->push_back(pos);
+            }
+            starts->push_back(pos);
+
+            Scan scan = { m->data, starts, &format, crc_, starts->size() - 1 };
+
+            parallel_for(starts->size() - 1, threads, verify, &scan);
+
+            starts->resize(scan.bad + 1);
+
+            if(starts->back() < m->size && ftruncate(fd_, starts->back()) < 0)
+                return errno;
+
+            size = starts->back();
+
+            return 0;
+        }
+
+        /* Returns 0, or an errno. */
+        int close()
+        {
+            int err = fd_ >= 0 ? commit() : 0;
+
+            if(fd_ >= 0 && ::close(fd_) < 0 && !err)
+                err = errno;
+            fd_ = -1;
+            return err;
+        }
+};
+
+/*
+AUTOSAR end-to-end protection of the messages of a signal, by profile P01,
+P02, P04, P05 or P07. A counter, a data ID, and for P04 and P07 the length,
+are inserted in a header, and a crc covers the message and the data ID, so
+that a receiver detects corrupt, lost, repeated and misrouted messages. The
+crc is computed over the message, skipping its own field, in one pass.
+*/
+class E2eProfile
+{
+    public:
+
+        enum Profile { P01, P02, P04, P05, P07 };
+        enum DataIdMode { BOTH, ALT, LOW, NIBBLE };
+        enum Status { OK, REPEATED, WRONGSEQUENCE, ERROR };
+
+    private:
+
+        CrcTable crc_;
+
+        static CrcParams params(Profile profile)
+        {
+            /* CRC-8/SAE-J1850 (started from 0 by P01), CRC-8H2F, CRC-32P4, CRC-16/CCITT-FALSE, CRC-64/XZ */
+            static const CrcParams crcs[] = {
+                { 8, 0x1D, 0, 0, false, false },
+                { 8, 0x2F, 0xFF, 0xFF, false, false },
+                { 32, 0xF4ACFB13, 0xFFFFFFFF, 0xFFFFFFFF, true, true },
+                { 16, 0x1021, 0xFFFF, 0, false, false },
+                { 64, 0x42F0E1EBA9EA3693ULL, ~(uint64_t) 0, ~(uint64_t) 0, true, true },
+            };
+            return crcs[profile];
+        }
+
+        static uint64_t getbe(const unsigned char* p, std::size_t n)
+        {
+            uint64_t v = 0;
+            for(std::size_t i = 0; i < n; i++) {
+                v = v << 8 | p[i];
+            }
+            return v;
+        }
+
+        static void putbe(unsigned char* p, std::size_t n, uint64_t v)
+        {
+            for(std::size_t i = n; i-- > 0; v >>= 8) {
+                p[i] = (unsigned char) v;
+            }
+        }
+
+        /* the nibble at a bit offset, 0 or 4 in its byte */
+        static unsigned getnibble(const unsigned char* p, std::size_t bit)
+        {
+            return (p[bit / 8] >> (bit % 8)) & 0xF;
+        }
+
+        static void putnibble(unsigned char* p, std::size_t bit, unsigned v)
+        {
+            p[bit / 8] = (p[bit / 8] & ~(0xF << (bit % 8))) | (v & 0xF) << (bit % 8);
+        }
+
+        /* The crc of a message of n bytes, with counter. */
+        uint64_t sum(const unsigned char* p, std::size_t n, uint32_t counter) const
+        {
+            uint64_t reg = crc_.init;
+            unsigned char id[2] = { (unsigned char) data_id, (unsigned char) (data_id >> 8) };
+
+            switch(profile) {
+                case P01:
+                    switch(data_id_mode) {
+                        case BOTH: reg = crc_.process(reg, id, 2); break;
+                        case ALT: reg = crc_.step(reg, id[counter % 2]); break;
+                        case LOW: reg = crc_.step(reg, id[0]); break;
+                        case NIBBLE: reg = crc_.step(crc_.step(reg, id[0]), 0); break;
+                    }
+                    reg = crc_.process(reg, p, offset);
+                    reg = crc_.process(reg, p + offset + 1, n - offset - 1);
+                    break;
+                case P02:
+                    reg = crc_.process(reg, p + 1, n - 1);
+                    reg = crc_.step(reg, data_ids[counter]);
+                    break;
+                case P04:
+                    reg = crc_.process(reg, p, offset + 8);
+                    reg = crc_.process(reg, p + offset + 12, n - offset - 12);
+                    break;
+                case P05:
+                    reg = crc_.process(reg, p, offset);
+                    reg = crc_.process(reg, p + offset + 2, n - offset - 2);
+                    reg = crc_.process(reg, id, 2);
+                    break;
+                case P07:
+                    reg = crc_.process(reg, p, offset);
+                    reg = crc_.process(reg, p + offset + 8, n - offset - 8);
+                    break;
+            }
+
+            return crc_.checksum(reg);
+        }
+
+    public:
+
+        Profile profile;
+        /* the data ID, or for P02 the list of them, one per counter value */
+        uint32_t data_id;
+        unsigned char data_ids[16];
+        int data_id_mode;
+        /* bytes to the header, for P01 to the crc */
+        std::size_t offset;
+        /* P01 bits to the counter, and to the nibble of the data ID */
+        std::size_t counter_offset;
+        std::size_t nibble_offset;
+        uint32_t max_delta;
+        /* counter of the next message sent, and of the last received */
+        uint32_t counter;
+        uint32_t last;
+        bool synced;
+
+        E2eProfile(Profile profile_)
+            : crc_(params(profile_)), profile(profile_), data_id(0), data_id_mode(BOTH), offset(0),
+              counter_offset(8), nibble_offset(12), max_delta(1), counter(0), last(0), synced(false)
+        {
+            memset(data_ids, 0, sizeof(data_ids));
+        }
+
+        /* The counter wraps to 0 after counter max - 1. */
+        uint64_t countermax() const
+        {
+            static const uint64_t max[] = { 15, 16, 65536, 256, (uint64_t) 1 << 32 };
+            return max[profile];
+        }
+
+        /* The least bytes in a message. */
+        std::size_t header() const
+        {
+            switch(profile) {
+                case P01:
+                    return std::max(std::max(offset + 1, counter_offset / 8 + 1),
+                            data_id_mode == NIBBLE ? nibble_offset / 8 + 1 : 0);
+                case P02: return 2;
+                case P04: return offset + 12;
+                case P05: return offset + 3;
+                case P07: return offset + 20;
+            }
+            return 0;
+        }
+
+        /* Fill in the header of a message of n >= header() bytes, for the next counter. */
+        void protect(unsigned char* p, std::size_t n)
+        {
+            switch(profile) {
+                case P01:
+                    putnibble(p, counter_offset, counter);
+                    if(data_id_mode == NIBBLE)
+                        putnibble(p, nibble_offset, data_id >> 8);
+                    p[offset] = sum(p, n, counter);
+                    break;
+                case P02:
+                    putnibble(p + 1, 0, counter);
+                    p[0] = sum(p, n, counter);
+                    break;
+                case P04:
+                    putbe(p + offset, 2, n);
+                    putbe(p + offset + 2, 2, counter);
+                    putbe(p + offset + 4, 4, data_id);
+                    putbe(p + offset + 8, 4, sum(p, n, counter));
+                    break;
+                case P05: {
+                    p[offset + 2] = counter;
+                    uint64_t crc = sum(p, n, counter);
+                    p[offset] = crc;
+                    p[offset + 1] = crc >> 8;
+                    break;
+                }
+                case P07:
+                    putbe(p + offset + 8, 4, n);
+                    putbe(p + offset + 12, 4, counter);
+                    putbe(p + offset + 16, 4, data_id);
+                    putbe(p + offset, 8, sum(p, n, counter));
+                    break;
+            }
+
+            counter = (counter + 1) % countermax();
+        }
+
+        /* Check a received message of n bytes, returning its status and counter. */
+        Status check(const unsigned char* p, std::size_t n, uint32_t* rx)
+        {
+            bool valid = n >= header();
+
+            if(valid) {
+                switch(profile) {
+                    case P01:
+                        *rx = getnibble(p, counter_offset);
+                        valid = *rx < countermax() && p[offset] == sum(p, n, *rx)
+                            && (data_id_mode != NIBBLE || getnibble(p, nibble_offset) == ((data_id >> 8) & 0xF));
+                        break;
+                    case P02:
+                        *rx = getnibble(p + 1, 0);
+                        valid = p[0] == sum(p, n, *rx);
+                        break;
+                    case P04:
+                        *rx = getbe(p + offset + 2, 2);
+                        valid = getbe(p + offset, 2) == n && getbe(p + offset + 4, 4) == data_id
+                            && getbe(p + offset + 8, 4) == sum(p, n, *rx);
+                        break;
+                    case P05:
+                        *rx = p[offset + 2];
+                        valid = (uint64_t) (p[offset] | p[offset + 1] << 8) == sum(p, n, *rx);
+                        break;
+                    case P07:
+                        *rx = getbe(p + offset + 12, 4);
+                        valid = getbe(p + offset + 8, 4) == n && getbe(p + offset + 16, 4) == data_id
+                            && getbe(p + offset, 8) == sum(p, n, *rx);
+                        break;
+                }
+            }
+
+            if(!valid)
+                return ERROR;
+
+            uint64_t delta = (*rx + countermax() - last) % countermax();
+            Status status = !synced || (delta > 0 && delta <= max_delta) ? OK : delta == 0 ? REPEATED : WRONGSEQUENCE;
+
+            if(status != REPEATED) {
+                last = *rx;
+                synced = true;
+            }
+
+            return status;
+        }
+};
+
+/*
+Walks the packets of an MPEG transport stream, reassembling the PSI/SI
+sections carried by a PID across its packets, and validating their
+CRC-32/MPEG-2. The PIDs of sections are the PAT, CAT and DVB SI PIDs, the
+PMTs and NIT of the programs of the PAT, and any given.
+*/
+class TsDemux
+{
+    public:
+
+        enum { PACKET = 188, SYNC = 0x47, NPIDS = 8192 };
+
+        struct Pid
+        {
+            uint64_t packets;
+            uint64_t cc_errors;
+            uint64_t sections;
+            uint64_t crc_errors;
+            /* sections of each table_id, for the PIDs of sections */
+            std::vector<uint64_t> tables;
+            int cc;
+            /* the section being reassembled */
+            std::vector<unsigned char> section;
+            bool assembling;
+
+            Pid() : packets(0), cc_errors(0), sections(0), crc_errors(0), cc(-1), assembling(false) {}
+        };
+
+    private:
+
+        Mpeg2Crc crc_;
+
+        /* A complete section of n bytes. */
+        void complete(std::size_t pid, const unsigned char* p, std::size_t n)
+        {
+            Pid& s = pids[pid];
+            unsigned table_id = p[0];
+            bool syntax = p[1] & 0x80;
+
+            s.sections++;
+            s.tables[table_id]++;
+
+            /* long form sections, and the TOT, end in a crc */
+            if(syntax || table_id == 0x73) {
+                if(n < 7 || crc_(p, n) != 0) {
+                    s.crc_errors++;
+                    return;
+                }
+            }
+
+            /* the PAT lists the PIDs of the PMTs, and of the NIT */
+            if(pid == 0 && table_id == 0 && syntax) {
+                for(std::size_t i = 8; i + 4 <= n - 4; i += 4) {
+                    sections((p[i + 2] & 0x1F) << 8 | p[i + 3]);
+                }
+            }
+        }
+
+        /* Sections starting at p, until stuffing, the last maybe incomplete. */
+        void start(std::size_t pid, const unsigned char* p, std::size_t n)
+        {
+            Pid& s = pids[pid];
+
+            while(n > 0 && p[0] != 0xFF) {
+                std::size_t total = n < 3 ? 0 : 3 + ((p[1] & 0x0F) << 8 | p[2]);
+                if(!total || total > n) {
+                    s.section.assign(p, p + n);
+                    s.assembling = true;
+                    return;
+                }
+                complete(pid, p, total);
+                p += total;
+                n -= total;
+            }
+        }
+
+        /* Bytes continuing a section, which end it if last. */
+        void resume(std::size_t pid, const unsigned char* p, std::size_t n, bool last)
+        {
+            Pid& s = pids[pid];
+
+            if(!s.assembling)
+                return;
+
+            s.section.insert(s.section.end(), p, p + n);
+
+            std::size_t total = s.section.size() < 3 ? 0 : 3 + ((s.section[1] & 0x0F) << 8 | s.section[2]);
+
+            if(total && total <= s.section.size()) {
+                complete(pid, &s.section[0], total);
+                s.assembling = false;
+            } else if(last) {
+                s.cc_errors++;
+                s.assembling = false;
+            }
+        }
+
+    public:
+
+        std::vector<Pid> pids;
+        std::size_t packet_size;
+        uint64_t packets;
+        uint64_t resyncs;
+        /* packets with the transport error indicator */
+        uint64_t errors;
+
+        TsDemux(std::size_t packet_size_)
+            : pids(NPIDS), packet_size(packet_size_), packets(0), resyncs(0), errors(0)
+        {
+            static const unsigned si[] = { 0x00, 0x01, 0x10, 0x11, 0x12, 0x13, 0x14 };
+            for(std::size_t i = 0; i < sizeof(si) / sizeof(si[0]); i++) {
+                sections(si[i]);
+            }
+        }
+
+        /* The PID carries sections. */
+        void sections(std::size_t pid)
+        {
+            if(pid < NPIDS && pids[pid].tables.empty())
+                pids[pid].tables.resize(256);
+        }
+
+        /* The packets of a stream of n bytes. */
+        void walk(const unsigned char* data, std::size_t n)
+        {
+            /* M2TS packets have a 4 byte timestamp before the sync byte */
+            std::size_t sync = packet_size == 192 ? 4 : 0;
+            std::size_t pos = 0;
+
+            while(pos + packet_size <= n) {
+                if(data[pos + sync] != SYNC) {
+                    /* find the next position of two sync bytes a packet apart */
+                    do {
+                        pos++;
+                    } while(pos + packet_size <= n && !(data[pos + sync] == SYNC
+                                && (pos + 2 * packet_size > n || data[pos + packet_size + sync] == SYNC)));
+                    resyncs++;
+                    continue;
+                }
+                packet(data + pos + sync);
+                pos += packet_size;
+            }
+        }
+
+        void packet(const unsigned char* p)
+        {
+            std::size_t pid = (p[1] & 0x1F) << 8 | p[2];
+            Pid& s = pids[pid];
+            bool pusi = p[1] & 0x40;
+            unsigned afc = (p[3] >> 4) & 3;
+            int cc = p[3] & 0xF;
+
+            packets++;
+            s.packets++;
+
+            if(p[1] & 0x80) {
+                errors++;
+                s.assembling = false;
+                return;
+            }
+
+            if(!(afc & 1))
+                return;
+
+            /* a packet may be sent twice, otherwise the counter increments */
+            if(s.cc >= 0 && cc == s.cc)
+                return;
+            if(s.cc >= 0 && cc != ((s.cc + 1) & 0xF)) {
+                s.cc_errors++;
+                s.assembling = false;
+            }
+            s.cc = cc;
+
+            if(s.tables.empty())
+                return;
+
+            std::size_t at = afc & 2 ? 5 + p[4] : 4;
+
+            if(at >= PACKET)
+                return;
+
+            const unsigned char* payload = p + at;
+            std::size_t n = PACKET - at;
+
+            if(!pusi) {
+                resume(pid, payload, n, false);
+                return;
+            }
+
+            std::size_t pointer = payload[0];
+
+            if(pointer >= n) {
+                s.assembling = false;
+                return;
+            }
+
+            resume(pid, payload + 1, pointer, true);
+            start(pid, payload + 1 + pointer, n - 1 - pointer);
+        }
+};
+
+/*
+Crc of an object of total bytes, from its segments in any order, each as its
+bytes or its crc. A crc is linear, so the remainder of the object without
+an initial register is the xor of the remainders of its segments, each
+shifted over the bytes following it. The segments aren't kept, only the
+ranges covered, to reject those that overlap.
+*/
+class Assembler
+{
+    private:
+
+        Crc* crc_;
+        CrcParams p_;
+        /* covered ranges, by start, of their ends, adjacent ranges merged */
+        std::map<uint64_t, uint64_t> ranges_;
+        uintmax_t acc_;
+
+        /* Add the remainder without initial register of a segment not yet covered. */
+        void add(uint64_t offset, uint64_t len, uintmax_t rem)
+        {
+            acc_ ^= crc_->gf2().shift(rem, total - offset - len);
+            covered += len;
+
+            std::map<uint64_t, uint64_t>::iterator next = ranges_.lower_bound(offset);
+            uint64_t end = offset + len;
+
+            if(next != ranges_.end() && next->first == end) {
+                end = next->second;
+                ranges_.erase(next++);
+            }
+            if(next != ranges_.begin()) {
+                std::map<uint64_t, uint64_t>::iterator prev = next;
+                if((--prev)->second == offset) {
+                    prev->second = end;
+                    return;
+                }
+            }
+            ranges_[offset] = end;
+        }
+
+    public:
+
+        uint64_t total;
+        uint64_t covered;
+
+        std::size_t bits() const
+        {
+            return p_.bits;
+        }
+
+        Assembler(const Crc* crc, uint64_t total_)
+            : crc_(crc->clone()), p_(crc->params()), acc_(0), total(total_), covered(0)
+        {
+        }
+
+        ~Assembler()
+        {
+            delete crc_;
+        }
+
+        /*
+        The first covered range overlapping offset..end, or end() if none
+        does.
+        */
+        std::map<uint64_t, uint64_t>::const_iterator overlap(uint64_t offset, uint64_t end) const
+        {
+            std::map<uint64_t, uint64_t>::const_iterator r = ranges_.upper_bound(offset);
+
+            if(r != ranges_.begin()) {
+                std::map<uint64_t, uint64_t>::const_iterator prev = r;
+                if((--prev)->second > offset)
+                    return prev;
+            }
+            return r != ranges_.end() && r->first < end ? r : ranges_.end();
+        }
+
+        bool overlaps(uint64_t offset, uint64_t len) const
+        {
+            return overlap(offset, offset + len) != ranges_.end();
+        }
+
+        /* Add the bytes of a segment, skipping any already covered. */
+        void add_bytes(uint64_t offset, const unsigned char* p, uint64_t len)
+        {
+            uint64_t end = offset + len;
+
+            while(offset < end) {
+                std::map<uint64_t, uint64_t>::const_iterator r = overlap(offset, end);
+                uint64_t stop = r == ranges_.end() ? end : std::max(r->first, offset);
+
+                if(stop > offset) {
+                    crc_->reset(0);
+                    crc_->process_bytes(p, stop - offset);
+                    add(offset, stop - offset, crc_->remainder());
+                }
+                if(r == ranges_.end())
+                    break;
+
+                uint64_t skip = std::min(r->second, end);
+                p += skip - offset;
+                offset = skip;
+            }
+        }
+
+        /* Add a segment by its checksum, which mustn't overlap those added. */
+        void add_checksum(uint64_t offset, uintmax_t checksum, uint64_t len)
+        {
+            const Gf2& g = crc_->gf2();
+            uintmax_t rem = (checksum ^ p_.xor_) & g.mask;
+
+            if(p_.reflect_remainder)
+                rem = Gf2::reflect(rem, g.bits);
+
+            add(offset, len, rem ^ g.shift(p_.initial & g.mask, len));
+        }
+
+        uintmax_t checksum() const
+        {
+            const Gf2& g = crc_->gf2();
+            uintmax_t rem = acc_ ^ g.shift(p_.initial & g.mask, total);
+
+            if(p_.reflect_remainder)
+                rem = Gf2::reflect(rem, g.bits);
+
+            return (rem ^ p_.xor_) & g.mask;
+        }
+};
+
+/*
+Pseudo-random binary sequence of a linear feedback shift register, as used to
+test links. Each bit is the xor of the earlier bits at the delays of the terms
+of the polynomial x^n + ... + 1, so for PRBS7, x^7 + x^6 + 1, bit i is bit i-7
+xor bit i-6. The bits are packed into bytes first bit in the msb.
+
+The next byte is linear in the last n bits, so it is generated a byte at a
+time by xoring a table entry for each byte of the state.
+*/
+class Prbs
+{
+    private:
+
+        /* 256 entries for each byte of the state */
+        std::vector<unsigned char> tables_;
+
+    public:
+
+        unsigned order;
+        uint64_t poly;
+        uint64_t mask;
+        bool invert;
+
+        /* The last order bits of the generator and the checker, the latest in bit 0. */
+        uint64_t state;
+        uint64_t check_state;
+        /* bytes the checker has still to receive before it is synchronized */
+        unsigned unsynced;
+
+        Prbs(unsigned order_, uint64_t poly_, uint64_t seed, bool invert_)
+            : order(order_), poly(poly_), invert(invert_)
+        {
+            unsigned nbytes = (order + 7) / 8;
+            uint64_t taps;
+
+            mask = order < 64 ? ((uint64_t) 1 << order) - 1 : ~(uint64_t) 0;
+            taps = (poly >> 1 | (uint64_t) 1 << (order - 1)) & mask;
+            state = seed & mask;
+
+            tables_.resize(nbytes * 256);
+            for(unsigned k = 0; k < nbytes; k++) {
+                for(unsigned v = 0; v < 256; v++) {
+                    uint64_t s = (uint64_t) v << 8 * k & mask;
+                    unsigned char out = 0;
+                    for(int i = 0; i < 8; i++) {
+                        unsigned bit = __builtin_parityll(s & taps);
+                        s = (s << 1 | bit) & mask;
+                        out = out << 1 | bit;
+                    }
+                    tables_[k * 256 + v] = out;
+                }
+            }
+
+            sync();
+        }
+
+        /* Returns the byte of the sequence following state. */
+        unsigned char next(uint64_t s) const
+        {
+            unsigned char out = 0;
+
+            for(std::size_t k = 0; k < tables_.size(); k += 256, s >>= 8) {
+                out ^= tables_[k + (s & 0xFF)];
+            }
+            return out;
+        }
+
+        void generate(unsigned char* p, std::size_t n)
+        {
+            unsigned char inv = invert ? 0xFF : 0;
+
+            for(std::size_t i = 0; i < n; i++) {
+                unsigned char out = next(state);
+                state = (state << 8 | out) & mask;
+                p[i] = out ^ inv;
+            }
+        }
+
+        /* Restart the checker, it synchronizes to the next bytes it receives. */
+        void sync()
+        {
+            check_state = 0;
+            unsynced = (order + 7) / 8;
+        }
+
+        /*
+        Check received bytes against the sequence. The checker is loaded with
+        the first bytes, after which it runs free, so that each bit error is
+        counted once. Returns the bit errors, and the count of bits checked.
+        */
+        uint64_t check(const unsigned char* p, std::size_t n, uint64_t* bits)
+        {
+            unsigned char inv = invert ? 0xFF : 0;
+            uint64_t errors = 0;
+            std::size_t i = 0;
+
+            for(; i < n && unsynced; i++, unsynced--) {
+                check_state = (check_state << 8 | (unsigned char) (p[i] ^ inv)) & mask;
+            }
+
+            *bits = (uint64_t) (n - i) * 8;
+
+            for(; i < n; i++) {
+                unsigned char expected = next(check_state);
+                check_state = (check_state << 8 | expected) & mask;
+                errors += __builtin_popcount((unsigned char) (p[i] ^ inv) ^ expected);
+            }
+
+            return errors;
+        }
+};
+
+/*
+A sparse memory image, loaded from Intel HEX or Motorola S-records.
+*/
+struct Firmware
+{
+    struct Segment
+    {
+        uint64_t address;
+        std::string bytes;
+        /* line of its first record */
+        std::size_t line;
+
+        uint64_t end() const
+        {
+            return address + bytes.size();
+        }
+
+        bool operator<(const Segment& s) const
+        {
+            return address < s.address;
+        }
+    };
+
+    std::vector<Segment> segments;
+    uint64_t start;
+    bool has_start;
+    /* line being parsed, and what is wrong with it */
+    std::size_t line;
+    const char* error;
+    std::vector<unsigned char> rec;
+
+    Firmware() : start(0), has_start(false), line(0), error(NULL) {}
+
+    static int hexval(unsigned char c)
+    {
+        if(c >= '0' && c <= '9')
+            return c - '0';
+        c |= 0x20;
+        if(c >= 'a' && c <= 'f')
+            return c - 'a' + 10;
+        return -1;
+    }
+
+    /* Decode the hex digits from p to end into rec, returns false if they aren't. */
+    bool decode(const unsigned char* p, const unsigned char* end)
+    {
+        rec.clear();
+        if((end - p) % 2) {
+            error = "odd number of hex digits";
+            return false;
+        }
+        for(; p < end; p += 2) {
+            int hi = hexval(p[0]);
+            int lo = hexval(p[1]);
+            if(hi < 0 || lo < 0) {
+                error = "invalid hex digit";
+                return false;
+            }
+            rec.push_back(hi << 4 | lo);
+        }
+        return true;
+    }
+
+    unsigned sum() const
+    {
+        unsigned s = 0;
+        for(std::size_t i = 0; i < rec.size(); i++) {
+            s += rec[i];
+        }
+        return s & 0xFF;
+    }
+
+    uint64_t be(std::size_t at, std::size_t n) const
+    {
+        uint64_t v = 0;
+        for(std::size_t i = 0; i < n; i++) {
+            v = v << 8 | rec[at + i];
+        }
+        return v;
+    }
+
+    void add(uint64_t address, const unsigned char* data, std::size_t n)
+    {
+        if(!n)
+            return;
+        if(segments.empty() || segments.back().end() != address) {
+            Segment s = { address, std::string(), line };
+            segments.push_back(s);
+        }
+        segments.back().bytes.append((const char*) data, n);
+    }
+
+    /* An Intel HEX record, :LLAAAATTDD..CC, returns false at the end of file. */
+    bool ihex(uint64_t* base)
+    {
+        if(rec.size() < 5 || rec[0] != rec.size() - 5) {
+            error = "bad record length";
+            return false;
+        }
+        if(sum() != 0) {
+            error = "bad checksum";
+            return false;
+        }
+
+        std::size_t n = rec[0];
+        uint64_t offset = be(1, 2);
+
+        switch(rec[3]) {
+            case 0:
+                add(*base + offset, &rec[4], n);
+                return true;
+            case 1:
+                return false;
+            case 2:
+            case 4:
+                if(n != 2)
+                    break;
+                *base = be(4, 2) << (rec[3] == 2 ? 4 : 16);
+                return true;
+            case 3:
+                if(n != 4)
+                    break;
+                start = be(4, 2) * 16 + be(6, 2);
+                has_start = true;
+                return true;
+            case 5:
+                if(n != 4)
+                    break;
+                start = be(4, 4);
+                has_start = true;
+                return true;
+        }
+        error = "bad record";
+        return false;
+    }
+
+    /* A Motorola S-record, STCCAA..DD..CC, returns false at the end of file. */
+    bool srec(unsigned char type)
+    {
+        /* address bytes of each record type */
+        static const unsigned char abytes[] = { 2, 2, 3, 4, 0, 2, 3, 4, 3, 2 };
+
+        if(type < '0' || type > '9' || type == '4') {
+            error = "bad record type";
+            return false;
+        }
+        type -= '0';
+        if(rec.size() < 2u + abytes[type] || rec[0] != rec.size() - 1) {
+            error = "bad record length";
+            return false;
+        }
+        if(sum() != 0xFF) {
+            error = "bad checksum";
+            return false;
+        }
+
+        std::size_t n = rec.size() - 2 - abytes[type];
+        uint64_t address = be(1, abytes[type]);
+
+        if(type >= 1 && type <= 3) {
+            add(address, &rec[1 + abytes[type]], n);
+        } else if(type >= 7) {
+            start = address;
+            has_start = true;
+            return false;
+        }
+        return true;
+    }
+
+    /* Returns false, with line and error set, if the records are invalid. */
+    bool parse(const unsigned char* p, std::size_t size)
+    {
+        const unsigned char* end = p + size;
+        uint64_t base = 0;
+        bool more = true;
+
+        while(more && p < end) {
+            const unsigned char* eol = (const unsigned char*) memchr(p, '\n', end - p);
+            const unsigned char* next = eol ? eol + 1 : end;
+
+            if(!eol)
+                eol = end;
+            while(eol > p && (eol[-1] == '\r' || eol[-1] == ' ' || eol[-1] == '\t'))
+                eol--;
+
+            line++;
+
+            if(eol == p) {
+                p = next;
+                continue;
+            }
+
+            if(p[0] == ':') {
+                if(!decode(p + 1, eol))
+                    return false;
+                more = ihex(&base);
+            } else if(p[0] == 'S' && eol - p >= 2) {
+                if(!decode(p + 2, eol))
+                    return false;
+                more = srec(p[1]);
+            } else {
+                error = "not a record";
+                return false;
+            }
+
+            if(error)
+                return false;
+
+            p = next;
+        }
+
+        return assemble();
+    }
+
+    /* Sort the segments, joining adjacent ones, and reject overlaps. */
+    bool assemble()
+    {
+        std::stable_sort(segments.begin(), segments.end());
+
+        std::size_t n = 0;
+        for(std::size_t i = 0; i < segments.size(); i++) {
+            if(n && segments[i].address < segments[n - 1].end()) {
+                line = segments[i].line;
+                error = "overlapping records";
+                return false;
+            }
+            if(n && segments[i].address == segments[n - 1].end()) {
+                segments[n - 1].bytes.append(segments[i].bytes);
+            } else if(n++ != i) {
+                segments[n - 1].address = segments[i].address;
+                segments[n - 1].line = segments[i].line;
+                segments[n - 1].bytes.swap(segments[i].bytes);
+            }
+        }
+        segments.resize(n);
+
+        return true;
+    }
+
+    /*
+    Continue crc over the length bytes of the image from address, with the
+    gaps between segments filled with fill bytes.
+    */
+    void process(Crc* crc, uint64_t address, uint64_t length, unsigned char fill) const
+    {
+        uint64_t end = address + length;
+        Segment key = { address, std::string(), 0 };
+        std::vector<Segment>::const_iterator it = std::upper_bound(segments.begin(), segments.end(), key);
+
+        if(it != segments.begin() && (it - 1)->end() > address)
+            --it;
+
+        if(crc->params().reflect_input)
+            fill = Gf2::reflect(fill, 8);
+
+        while(address < end) {
+            uint64_t stop;
+
+            if(it != segments.end() && it->address <= address) {
+                stop = std::min(end, it->end());
+                crc->process_bytes(it->bytes.data() + (address - it->address), stop - address);
+                ++it;
+            } else {
+                stop = it == segments.end() ? end : std::min(end, it->address);
+                crc->reset(crc->gf2().repeat(crc->remainder(), stop - address, fill));
+            }
+
+            address = stop;
+        }
+    }
+};
+
+/*
+Moves bytes from one file descriptor to another, processing them into a crc
+on the way, with as few copies as the descriptors allow:
+
+  - from a regular file, a window of the file is mapped for the crc, and
+    sendfile() moves the bytes within the kernel
+  - from a pipe, tee() duplicates the bytes into a private pipe, which is read
+    for the crc, and splice() moves the originals within the kernel
+  - otherwise, the bytes are read into a buffer, and written from it
+*/
+struct Relay
+{
+    static const std::size_t CHUNK = 1 << 20;
+
+    int in;
+    int out;
+    Crc* crc;
+    uint64_t moved;
+    std::vector<unsigned char> buffer;
+    /* private pipe for tee() */
+    int tee_r;
+    int tee_w;
+
+    Relay(int in_, int out_, Crc* crc_)
+        : in(in_), out(out_), crc(crc_), moved(0), tee_r(-1), tee_w(-1)
+    {
+    }
+
+    ~Relay()
+    {
+        if(tee_r >= 0) {
+            close(tee_r);
+            close(tee_w);
+        }
+    }
+
+    static int writeall(int fd, const unsigned char* p, std::size_t n)
+    {
+        while(n) {
+            ssize_t w = write(fd, p, n);
+            if(w < 0 && errno == EINTR)
+                continue;
+            if(w < 0)
+                return errno;
+            p += w;
+            n -= w;
+        }
+        return 0;
+    }
+
+    static int readall(int fd, unsigned char* p, std::size_t n)
+    {
+        while(n) {
+            ssize_t r = read(fd, p, n);
+            if(r < 0 && errno == EINTR)
+                continue;
+            if(r <= 0)
+                return r < 0 ? errno : EIO;
+            p += r;
+            n -= r;
+        }
+        return 0;
+    }
+
+    /* Returns 0, or an errno. Len is the most bytes to move. */
+    int run(uint64_t len)
+    {
+        struct stat st;
+
+        if(fstat(in, &st) < 0)
+            return errno;
+        if(S_ISREG(st.st_mode))
+            return file(len, st.st_size);
+        if(S_ISFIFO(st.st_mode))
+            return pipe(len);
+        return bounce(len);
+    }
+
+    int bounce(uint64_t len)
+    {
+        buffer.resize(CHUNK);
+
+        while(moved < len) {
+            ssize_t n = read(in, &buffer[0], std::min<uint64_t>(CHUNK, len - moved));
+            if(n < 0 && errno == EINTR)
+                continue;
+            if(n < 0)
+                return errno;
+            if(n == 0)
+                break;
+            crc->process_bytes(&buffer[0], n);
+            if(int err = writeall(out, &buffer[0], n))
+                return err;
+            moved += n;
+        }
+        return 0;
+    }
+
+    int file(uint64_t len, uint64_t size)
+    {
+        off_t pos = lseek(in, 0, SEEK_CUR);
+        uint64_t page = sysconf(_SC_PAGESIZE);
+        bool send = true;
+
+        if(pos < 0)
+            return bounce(len);
+        if(size > (uint64_t) pos && len > size - pos)
+            len = size - pos;
+
+        while(moved < len && (uint64_t) pos < size) {
+            std::size_t chunk = std::min<uint64_t>(CHUNK, len - moved);
+            off_t base = pos & ~(off_t) (page - 1);
+            std::size_t maplen = pos - base + chunk;
+            void* map = mmap(NULL, maplen, PROT_READ, MAP_SHARED, in, base);
+
+            if(map == MAP_FAILED)
+                return moved ? errno : bounce(len);
+
+            const unsigned char* p = (const unsigned char*) map + (pos - base);
+            int err = 0;
+
+            crc->process_bytes(p, chunk);
+
+            for(std::size_t sent = 0; send && sent < chunk; ) {
+                ssize_t n = sendfile(out, in, NULL, chunk - sent);
+                if(n < 0 && errno == EINTR)
+                    continue;
+                if(n < 0 && sent == 0 && (errno == EINVAL || errno == ENOSYS)) {
+                    send = false;
+                    break;
+                }
+                if(n <= 0) {
+                    err = n < 0 ? errno : EIO;
+                    break;
+                }
+                sent += n;
+            }
+
+            /* the output can't take sendfile(), write from the mapping */
+            if(!send && !err) {
+                err = writeall(out, p, chunk);
+                if(!err && lseek(in, pos + chunk, SEEK_SET) < 0)
+                    err = errno;
+            }
+
+            munmap(map, maplen);
+
+            if(err)
+                return err;
+
+            pos += chunk;
+            moved += chunk;
+        }
+        return 0;
+    }
+
+    int pipe(uint64_t len)
+    {
+        int fds[2];
+        bool spliced = true;
+
+        if(pipe2(fds, O_CLOEXEC) < 0)
+            return errno;
+        tee_r = fds[0];
+        tee_w = fds[1];
+        fcntl(tee_w, F_SETPIPE_SZ, (int) CHUNK);
+        buffer.resize(CHUNK);
+
+        while(moved < len) {
+            ssize_t n = tee(in, tee_w, std::min<uint64_t>(CHUNK, len - moved), 0);
+            if(n < 0 && errno == EINTR)
+                continue;
+            if(n < 0 && moved == 0 && errno == EINVAL)
+                return bounce(len);
+            if(n < 0)
+                return errno;
+            if(n == 0)
+                break;
+            if(int err = readall(tee_r, &buffer[0], n))
+                return err;
+
+            crc->process_bytes(&buffer[0], n);
+
+            for(ssize_t left = n; spliced && left; ) {
+                ssize_t m = splice(in, NULL, out, NULL, left, SPLICE_F_MOVE);
+                if(m < 0 && errno == EINTR)
+                    continue;
+                if(m < 0 && left == n && errno == EINVAL) {
+                    spliced = false;
+                    break;
+                }
+                if(m <= 0)
+                    return m < 0 ? errno : EIO;
+                left -= m;
+            }
+
+            /* the output can't take splice(), consume the bytes and write them */
+            if(!spliced) {
+                if(int err = readall(in, &buffer[0], n))
+                    return err;
+                if(int err = writeall(out, &buffer[0], n))
+                    return err;
+            }
+
+            moved += n;
+        }
+        return 0;
+    }
+};
+
+extern "C" {
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+}
+
+#undef LUALIB_API
+#define LUALIB_API extern "C"
+
+static void v_obj_metatable(lua_State* L, const char* regid, const struct luaL_reg methods[])
+{
+    /* metatable = { ... methods ... } */
+    luaL_newmetatable(L, regid);
+    luaL_register(L, NULL, methods);
+    /* metatable["__index"] = metatable */
+    lua_pushvalue(L, -1);
+    lua_setfield(L, -2, "__index");
+    lua_pop(L, 1);
+}
+
+static ptrdiff_t posrelat(ptrdiff_t pos, size_t len)
+{
+    /* relative string position: negative means back from end */
+    if (pos < 0) pos += (ptrdiff_t)len + 1;
+    return (pos >= 0) ? pos : 0;
+}
+
+/* Returns userdata at idx if it has metatable regid, otherwise NULL. */
+static void* v_toudata(lua_State* L, int idx, const char* regid)
+{
+    void* ud = lua_touserdata(L, idx);
+
+    if(ud && lua_getmetatable(L, idx)) {
+        luaL_getmetatable(L, regid);
+        if(!lua_rawequal(L, -1, -2))
+            ud = NULL;
+        lua_pop(L, 2);
+    } else {
+        ud = NULL;
+    }
+
+    return ud;
+}
+
+#define L_BUFFER_REGID "wt.bcrc.buffer"
+
+/* Returns the bytes of the buffer at idx, or NULL if it isn't one. */
+static char* v_tobuffer(lua_State* L, int idx, size_t* lp)
+{
+    char* b = (char*) v_toudata(L, idx, L_BUFFER_REGID);
+
+    if(b)
+        *lp = lua_objlen(L, idx);
+
+    return b;
+}
+
+/*
+Substring of a string, or of a buffer, see crc:process().
+*/
+static const char* v_checksubstring(lua_State *L, int narg, size_t* lp)
+{
+    size_t l;
+    const char *s = v_tobuffer(L, narg, &l);
+    if (!s) s = luaL_checklstring(L, narg, &l);
+    ptrdiff_t start = posrelat(luaL_optinteger(L, narg+1, 1), l);
+    ptrdiff_t end = posrelat(luaL_optinteger(L, narg+2, -1), l);
+    if (start < 1) start = 1;
+    if (end > (ptrdiff_t)l) end = (ptrdiff_t)l;
+    if (start <= end) {
+        *lp = end-start+1;
+        return s+start-1;
+    } else {
+        *lp = 0;
+        return "";
+    }
+}
+
+#define L_CRC_REGID "wt.bcrc"
+
+static Crc* checkudata(lua_State* L, int narg = 1)
+{
+    Crc** ud = (Crc**) luaL_checkudata(L, narg, L_CRC_REGID);
+
+    luaL_argcheck(L, *ud, narg, "bcrc state has been destroyed");
+
+    return *ud;
+}
+
+/* Returns crc object at idx, or NULL if it isn't one. */
+static Crc* tocrc(lua_State* L, int idx)
+{
+    Crc** ud = (Crc**) v_toudata(L, idx, L_CRC_REGID);
+
+    return ud ? *ud : NULL;
+}
+
+static Crc** newudata(lua_State* L)
+{
+    Crc** ud = (Crc**) lua_newuserdata(L, sizeof(*ud));
+    *ud = NULL;
+
+    luaL_getmetatable(L, L_CRC_REGID);
+    lua_setmetatable(L, -2);
+
+    return ud;
+}
+
+/*
+Generic userdata holding a pointer to a C++ object, for the types other than
+the crc object.
+*/
+template < class T >
+static T** v_newudata(lua_State* L, const char* regid)
+{
+    T** ud = (T**) lua_newuserdata(L, sizeof(*ud));
+    *ud = NULL;
+
+    luaL_getmetatable(L, regid);
+    lua_setmetatable(L, -2);
+
+    return ud;
+}
+
+template < class T >
+static T* v_checkudata(lua_State* L, int narg, const char* regid)
+{
+    T** ud = (T**) luaL_checkudata(L, narg, regid);
+
+    luaL_argcheck(L, *ud, narg, "object has been destroyed");
+
+    return *ud;
+}
+
+template < class T >
+static int v_gcudata(lua_State* L, const char* regid)
+{
+    T** ud = (T**) luaL_checkudata(L, 1, regid);
+    delete *ud;
+    *ud = NULL;
+    return 0;
+}
+
+static int v_pusherror(lua_State* L, int err)
+{
+    lua_pushnil(L);
+    lua_pushstring(L, strerror(err));
+    lua_pushinteger(L, err);
+    return 3;
+}
+
+/*
+Optional fields of an options table. The table is optional, if the value at
+idx isn't a table, the defaults are returned.
+*/
+static void v_opttable(lua_State* L, int narg)
+{
+    if(!lua_isnoneornil(L, narg))
+        luaL_checktype(L, narg, LUA_TTABLE);
+}
+
+static lua_Integer v_optintfield(lua_State* L, int idx, const char* k, lua_Integer def)
+{
+    lua_Integer v = def;
+    if(!lua_istable(L, idx))
+        return v;
+    lua_getfield(L, idx, k);
+    if(!lua_isnil(L, -1)) {
+        if(!lua_isnumber(L, -1))
+            luaL_error(L, "option '%s' must be a number", k);
+        v = lua_tointeger(L, -1);
+    }
+    lua_pop(L, 1);
+    return v;
+}
+
+static lua_Number v_optnumberfield(lua_State* L, int idx, const char* k, lua_Number def)
+{
+    lua_Number v = def;
+    if(!lua_istable(L, idx))
+        return v;
+    lua_getfield(L, idx, k);
+    if(!lua_isnil(L, -1)) {
+        if(!lua_isnumber(L, -1))
+            luaL_error(L, "option '%s' must be a number", k);
+        v = lua_tonumber(L, -1);
+    }
+    lua_pop(L, 1);
+    return v;
+}
+
+static bool v_optboolfield(lua_State* L, int idx, const char* k, bool def)
+{
+    bool v = def;
+    if(!lua_istable(L, idx))
+        return v;
+    lua_getfield(L, idx, k);
+    if(!lua_isnil(L, -1))
+        v = lua_toboolean(L, -1);
+    lua_pop(L, 1);
+    return v;
+}
+
+static int v_optoptionfield(lua_State* L, int idx, const char* k, int def, const char* const lst[])
+{
+    int v = def;
+    if(!lua_istable(L, idx))
+        return v;
+    lua_getfield(L, idx, k);
+    if(!lua_isnil(L, -1)) {
+        const char* o = lua_tostring(L, -1);
+        for(v = 0; o && lst[v]; v++) {
+            if(strcmp(o, lst[v]) == 0)
+                break;
+        }
+        if(!o || !lst[v])
+            luaL_error(L, "invalid value for option '%s'", k);
+    }
+    lua_pop(L, 1);
+    return v;
+}
+
+/*
+Options table field "crc" is a crc object, defaulting to bcrc.crc32(). The
+object is borrowed from the options table, so clone() it to keep it.
+*/
+static const Crc* v_optcrcfield(lua_State* L, int idx)
+{
+    static const CrcOptimal<boost::crc_32_type> crc32;
+    const Crc* crc = &crc32;
+    if(lua_istable(L, idx)) {
+        lua_getfield(L, idx, "crc");
+        if(!lua_isnil(L, -1)) {
+            crc = tocrc(L, -1);
+            if(!crc)
+                luaL_error(L, "option 'crc' must be a bcrc object");
+        }
+        lua_pop(L, 1);
+    }
+    return crc;
+}
+
+/*
+Options table fields describing an embedded crc:
+
+  - crc_pos="tail"|"head", defaults to "tail"
+  - endian="big"|"little", defaults to "little" for crcs with
+    reflect_remainder, otherwise "big"
+*/
+static FrameCrc v_optframecrc(lua_State* L, int idx, const Crc* crc)
+{
+    static const char* const pos[] = { "tail", "head", NULL };
+    static const char* const endian[] = { "big", "little", NULL };
+    CrcParams p = crc->params();
+    FrameCrc f;
+    f.size = (p.bits + 7) / 8;
+    f.head = v_optoptionfield(L, idx, "crc_pos", 0, pos) == 1;
+    f.little = v_optoptionfield(L, idx, "endian", p.reflect_remainder, endian) == 1;
+    return f;
+}
+
+/*
+Functions taking path_or_bytes accept a path to a file, which is mapped into
+memory, or if the options table at opts has data=true, the bytes themselves.
+
+Returns 0, or an errno.
+*/
+static int v_checkinput(lua_State* L, int narg, int opts, Mapping* m)
+{
+    size_t size;
+    const char* s = luaL_checklstring(L, narg, &size);
+
+    if(v_optboolfield(L, opts, "data", false)) {
+        m->borrow(s, size);
+        return 0;
+    }
+
+    return m->map(s);
+}
+
+#define L_ARRAY_REGID "wt.bcrc.array"
+
+/*-
+- array = bcrc.array(bits, [n])
+
+Create an array of n zero unsigned integers of 16, 32 or 64 bits, packed in
+2, 4 or 8 bytes each, for holding many checksums compactly. N defaults to 0.
+
+Array[i] is element i, counting from 1, or nil if there isn't one, and
+array[i] = v sets it, or appends v if i is #array + 1. Its length is #array.
+Elements are Lua numbers, so those of 64 bit arrays are exact only up to
+2^53, though the array itself holds all 64 bits.
+
+Batch functions with an into option, bcrc.records(), crc:verify_many() and
+bcrc.t10pi(), append their checksums to the array, bcrc.records() instead of
+returning them.
+*/
+static int bcrc_array(lua_State* L)
+{
+    lua_Integer bits = luaL_checkinteger(L, 1);
+    lua_Number n = luaL_optnumber(L, 2, 0);
+
+    luaL_argcheck(L, bits == 16 || bits == 32 || bits == 64, 1, "bits must be 16, 32 or 64");
+    luaL_argcheck(L, n >= 0, 2, "n must not be negative");
+
+    CrcArray** ud = v_newudata<CrcArray>(L, L_ARRAY_REGID);
+
+    *ud = new CrcArray(bits, (std::size_t) n);
+
+    return 1;
+}
+
+static CrcArray* v_checkarray(lua_State* L, int narg)
+{
+    return v_checkudata<CrcArray>(L, narg, L_ARRAY_REGID);
+}
+
+/* Optional array field of an options table, that batch results are appended to. */
+static CrcArray* v_optintofield(lua_State* L, int idx, std::size_t bits)
+{
+    CrcArray* a = NULL;
+
+    if(lua_istable(L, idx)) {
+        lua_getfield(L, idx, "into");
+        if(!lua_isnil(L, -1)) {
+            a = v_checkarray(L, -1);
+            if(bits > a->width * 8)
+                luaL_error(L, "into array is narrower than the crc");
+        }
+        lua_pop(L, 1);
+    }
+
+    return a;
+}
+
+/* Appends the values to the array, if there is one. */
+template < class T >
+static void v_appendinto(CrcArray* a, const std::vector<T>& values)
+{
+    if(!a)
+        return;
+    a->reserve(a->size() + values.size());
+    for(std::size_t i = 0; i < values.size(); i++) {
+        a->push(values[i]);
+    }
+}
+
+/* Whether v is an integer that fits in an element of the array. */
+static bool v_inarray(const CrcArray* a, lua_Number v)
+{
+    if(v < 0 || v != floor(v))
+        return false;
+    /* the max of a 64 bit array isn't a double, 2^64 is */
+    return a->width == 8 ? v < 18446744073709551616.0 : v <= a->max();
+}
+
+static int bcrc_array_index(lua_State* L)
+{
+    CrcArray* a = v_checkarray(L, 1);
+
+    if(lua_type(L, 2) == LUA_TNUMBER) {
+        lua_Number i = lua_tonumber(L, 2);
+        if(i >= 1 && i <= a->size())
+            lua_pushnumber(L, a->get((std::size_t) i - 1));
+        else
+            lua_pushnil(L);
+        return 1;
+    }
+
+    lua_getmetatable(L, 1);
+    lua_pushvalue(L, 2);
+    lua_rawget(L, -2);
+
+    return 1;
+}
+
+static int bcrc_array_newindex(lua_State* L)
+{
+    CrcArray* a = v_checkarray(L, 1);
+    lua_Number i = luaL_checknumber(L, 2);
+    lua_Number v = luaL_checknumber(L, 3);
+
+    luaL_argcheck(L, i >= 1 && i <= a->size() + 1, 2, "index out of range");
+    luaL_argcheck(L, v_inarray(a, v), 3, "value out of range");
+
+    if(i == a->size() + 1)
+        a->push((uint64_t) v);
+    else
+        a->set((std::size_t) i - 1, (uint64_t) v);
+
+    return 0;
+}
+
+static int bcrc_array_len(lua_State* L)
+{
+    lua_pushnumber(L, v_checkarray(L, 1)->size());
+    return 1;
+}
+
+/*-
+- array = array:sort()
+
+Sort the array in ascending order, in place.
+*/
+static int bcrc_array_sort(lua_State* L)
+{
+    v_checkarray(L, 1)->sort();
+    lua_settop(L, 1);
+    return 1;
+}
+
+/*-
+- i = array:search(v)
+
+Returns the index of the first element of the sorted array equal to v, or nil
+if there is none.
+*/
+static int bcrc_array_search(lua_State* L)
+{
+    CrcArray* a = v_checkarray(L, 1);
+    lua_Number v = luaL_checknumber(L, 2);
+
+    luaL_argcheck(L, a->sorted, 1, "array is not sorted");
+
+    std::size_t i = v_inarray(a, v) ? a->search((uint64_t) v) : a->size();
+
+    if(i == a->size())
+        lua_pushnil(L);
+    else
+        lua_pushnumber(L, i + 1);
+
+    return 1;
+}
+
+/*-
+- n = array:duplicates()
+
+Returns the count of elements of the sorted array equal to the one before
+them, so of checksums that collide with another.
+*/
+static int bcrc_array_duplicates(lua_State* L)
+{
+    CrcArray* a = v_checkarray(L, 1);
+
+    luaL_argcheck(L, a->sorted, 1, "array is not sorted");
+
+    lua_pushnumber(L, a->duplicates());
+
+    return 1;
+}
+
+/*-
+- common = array:intersect(other)
+
+Returns a sorted array, as wide as array, of the values in both the sorted
+array and the sorted other array, each once. Other may be of a different
+width.
+*/
+static int bcrc_array_intersect(lua_State* L)
+{
+    CrcArray* a = v_checkarray(L, 1);
+    CrcArray* b = v_checkarray(L, 2);
+
+    luaL_argcheck(L, a->sorted, 1, "array is not sorted");
+    luaL_argcheck(L, b->sorted, 2, "array is not sorted");
+
+    CrcArray** ud = v_newudata<CrcArray>(L, L_ARRAY_REGID);
+
+    *ud = new CrcArray(a->width * 8, 0);
+    a->intersect(*b, *ud);
+
+    return 1;
+}
+
+static int bcrc_array_gc(lua_State* L)
+{
+    return v_gcudata<CrcArray>(L, L_ARRAY_REGID);
+}
+
+static const luaL_reg bcrc_array_methods[] =
+{
+    {"sort",         bcrc_array_sort},
+    {"search",       bcrc_array_search},
+    {"duplicates",   bcrc_array_duplicates},
+    {"intersect",    bcrc_array_intersect},
+    {"__newindex",   bcrc_array_newindex},
+    {"__len",        bcrc_array_len},
+    {"__gc",         bcrc_array_gc},
+    {NULL, NULL}
+};
+
+/*-
+- crc = bcrc.new(bits, poly[, initial, xor, reflect_input, reflect_remainder, [options]])
+
+Mandatory args:
+
+  - bits=n, where n is 8, 16, 24, 32, or with shared=true, 1 to 32
+  - poly=n, where n is the polynomial
+
+Optional args:
+
+  - initial=n, where n is the initial value for the crc, defaults to 0
+  - xor=n, where n is the value to xor with the final value, defaults to 0
+  - reflect_input=bool, defaults to false
+  - reflect_remainder=bool, defaults to false
+  - options, a table:
+    - shared=bool, whether to keep the crc's table in shared memory,
+      defaults to false
+
+The crc is table driven, crcs of 8 and 16 bits with tables of nibbles, and
+long buffers are processed as several streams at once, whose crcs are then
+combined, which is faster where carry-less multiplication isn't available.
+
+The table of a shared crc is built by the first process on the host to use
+the polynomial, in a shared memory segment named /bcrc-table-<hash>, and
+mapped read-only by the others, so the workers of a pre-forking server share
+one copy of it. Only segments created by the same user are used, and their
+tables are checked before use. A segment left incomplete by a process that
+died while building it is built again. If the segment can't be created or
+mapped, the process builds its own table. The segment persists until it is
+removed, with bcrc.shared_unlink().
+
+Returns a crc object.
+*/
+static int bcrc_new(lua_State *L)
+{
+    CrcParams p;
+
+    p.bits = luaL_checkint(L, 1);
+    p.poly = luaL_checkint(L, 2);
+    p.initial = luaL_optint(L, 3, 0);
+    p.xor_ = luaL_optint(L, 4, 0);
+    p.reflect_input = lua_toboolean(L, 5);
+    p.reflect_remainder = lua_toboolean(L, 6);
+    v_opttable(L, 7);
+
+    bool shared = v_optboolfield(L, 7, "shared", false);
+
+    if(shared)
+        luaL_argcheck(L, p.bits >= 1 && p.bits <= 32, 1, "bits must be 1 to 32");
+    else
+        luaL_argcheck(L, p.bits == 8 || p.bits == 16 || p.bits == 24 || p.bits == 32, 2, "unsupported crc bit width");
+
+    uintmax_t mask = ((uintmax_t) 2 << (p.bits - 1)) - 1;
+
+    p.poly &= mask;
+    p.initial &= mask;
+    p.xor_ &= mask;
+
+    Crc** ud = newudata(L);
+
+    if(shared)
+        *ud = new CrcTabled(p, SharedTable::get(p));
+    else if(p.bits <= 16)
+        *ud = new CrcNibbled(p);
+    else
+        *ud = new CrcTabled(p, NULL);
+
+    return 1;
+}
+
+/*-
+- ok = bcrc.shared_unlink(bits, poly, [reflect_input])
+
+Remove the shared memory segment holding the table of crcs with the
+parameters, created by bcrc.new() with shared=true. Processes using the table
+may continue using it, the next to create such a crc builds it again.
+
+Returns true, or nil, errmsg, errno on failure.
+*/
+static int bcrc_shared_unlink(lua_State* L)
+{
+    CrcParams p;
+    char name[64];
+
+    p.bits = luaL_checkint(L, 1);
+    p.poly = luaL_checkint(L, 2);
+    p.reflect_input = lua_toboolean(L, 3);
+
+    luaL_argcheck(L, p.bits >= 1 && p.bits <= 32, 1, "bits must be 1 to 32");
+
+    p.poly &= ((uintmax_t) 2 << (p.bits - 1)) - 1;
+
+    SharedTable::name(p, name, sizeof(name));
+
+    if(shm_unlink(name) < 0)
+        return v_pusherror(L, errno);
+
+    lua_pushboolean(L, 1);
+
+    return 1;
+}
+
+/*-
+- crc = bcrc.crc16()
+
+An optimal implementation of bcrc.new(16, 0x8005, 0, 0, true, true).
+*/
+
+/*-
+- crc = bcrc.ccitt()
+
+An optimal implementation of bcrc.new(16, 0x1021, 0xFFFF, 0, false, false).
+*/
+
+/*-
+- crc = bcrc.xmodem()
+
+An optimal implementation of bcrc.new(16, 0x8408, 0, 0, true, true).
+*/
+
+/*-
+- crc = bcrc.crc32()
+
+An optimal implementation of bcrc.new(32, 0x04C11DB7, 0xFFFFFFFF, 0xFFFFFFFF, true, true).
+*/
+
+/*-
+- crc = bcrc.t10dif()
+
+An optimal implementation of bcrc.new(16, 0x8BB7, 0, 0, false, false).
+*/
+
+/*-
+- crc = bcrc.mpeg2()
+
+An optimal implementation of bcrc.new(32, 0x04C11DB7, 0xFFFFFFFF, 0, false, false).
+*/
+
+/*
+Above methods are all instantiated from a single template function.
+*/
+template < class Optimal >
+static int bcrc_optimal(lua_State* L)
+{
+    Crc** ud = newudata(L);
+    *ud = new CrcOptimal<Optimal>();
+    luaL_argcheck(L, *ud, 1, "out of memory");
+    return 1;
+}
+
+/*-
+- self = crc:reset()
+
+Resets the crc to it's initial state.
+
+Returns the crc object.
+*/
+static int bcrc_reset (lua_State *L)
+{
+    Crc* ud = checkudata(L);
+    ud->reset();
+    return 1;
+}
+
+/*-
+- self = crc:process(bytes, [start, [, end]])
+
+Process substring of bytes from start..end.
+
+If end is absent, it defaults to -1, the end of the bytes.
+If start is absent, it defaults to 1, the start of the bytes.
+
+Substrings of up to 16 bytes are staged, and processed together, so
+processing a message a field at a time is cheap.
+
+Returns the crc object.
+*/
+static int bcrc_process(lua_State *L)
+{
+    Crc* ud = checkudata(L);
+    size_t size = 0;
+    const void* bytes = v_checksubstring(L, 2, &size);
+
+    bool sampled = ud->shadow && ud->shadow->due();
+    uintmax_t before = sampled ? ud->remainder() : 0;
+
+    ud->process_bytes(bytes, size);
+
+    if(sampled && !ud->shadow->check(before, bytes, size, ud) && ud->shadow->callback != LUA_NOREF) {
+        lua_rawgeti(L, LUA_REGISTRYINDEX, ud->shadow->callback);
+        lua_pushvalue(L, 1);
+        lua_pushnumber(L, ud->shadow->reference->checksum());
+        lua_pushnumber(L, ud->checksum());
+        lua_call(L, 3, 0);
+    }
+
+    lua_settop(L, 1);
+
+    return 1;
+}
+
+#if 0
+    /*-
+    - self = crc:process_bit(bool)
+
+    Process a single bit, a boolean.
+
+    Returns the crc object.
+
+    TODO - if necessary (but it can't be supported by optimal implementations)
+    */
+    static int bcrc_process_bit(lua_State *L)
+    {
+        Crc* ud = checkudata(L);
+
+        luaL_checktype(L, 2, LUA_TBOOLEAN);
+
+        ud->process_bit(lua_toboolean(L, 2));
+
+        lua_settop(L, 1);
+
+        return 1;
+    }
+#endif
+
+/*-
+- checksum = crc:checksum()
+
+Returns the current crc checksum (it is possible to keep calling process()
+after this).
+*/
+static int bcrc_checksum (lua_State *L)
+{
+    Crc* ud = checkudata(L);
+    lua_pushinteger(L, ud->checksum());
+    return 1;
+}
+
+/*-
+- checksum = crc(bytes, ...)
+
+Checksum in a single call, so
+
+  checksum = crc(bytes, start, end)
+
+is a short form for
+
+  checksum = crc:reset():process(bytes, start, end):checksum()
+
+See crc:process() for a description of bytes, start, end, and their default values.
+*/
+static int bcrc_call (lua_State *L)
+{
+    bcrc_reset(L);
+    bcrc_process(L);
+    return bcrc_checksum(L);
+}
+
+/*
+Crc polynomial arithmetic is on values in the crc's register bit order,
+reflected if the crc has reflect_input, so they combine directly with
+checksums of crcs that reflect both input and remainder.
+*/
+static uintmax_t v_checkpoly(lua_State* L, int narg)
+{
+    return (uintmax_t) (int64_t) luaL_checknumber(L, narg);
+}
+
+static uintmax_t v_toreg(const Crc* crc, uintmax_t v)
+{
+    const Gf2& g = crc->gf2();
+    return crc->params().reflect_input ? Gf2::reflect(v, g.bits) : v & g.mask;
+}
+
+static int v_pushreg(lua_State* L, const Crc* crc, uintmax_t v)
+{
+    lua_pushnumber(L, v_toreg(crc, v));
+    return 1;
+}
+
+/*-
+- p = crc:xpow(n)
+
+Returns x^n modulo the crc's polynomial.
+
+The polynomial arithmetic methods xpow(), mulmod() and shift() operate on
+polynomials of the crc's width, in the bit order of the crc's register: if
+the crc has reflect_input, the coefficient of x^0 is the most significant bit,
+otherwise it is the least significant bit.
+*/
+static int bcrc_xpow(lua_State *L)
+{
+    Crc* ud = checkudata(L);
+    lua_Number n = luaL_checknumber(L, 2);
+
+    luaL_argcheck(L, n >= 0, 2, "n must not be negative");
+
+    return v_pushreg(L, ud, ud->gf2().xpow((uint64_t) n));
+}
+
+/*-
+- p = crc:mulmod(a, b)
+
+Returns a * b modulo the crc's polynomial.
+*/
+static int bcrc_mulmod(lua_State *L)
+{
+    Crc* ud = checkudata(L);
+    uintmax_t a = v_toreg(ud, v_checkpoly(L, 2));
+    uintmax_t b = v_toreg(ud, v_checkpoly(L, 3));
+
+    return v_pushreg(L, ud, ud->gf2().mulmod(a, b));
+}
+
+/*-
+- reg = crc:shift(reg, nbytes)
+
+Returns the crc register value reg advanced over nbytes of zero bytes, that is
+reg * x^(8 * nbytes) modulo the crc's polynomial. No initial or final xor
+values are applied.
+*/
+static int bcrc_shift(lua_State *L)
+{
+    Crc* ud = checkudata(L);
+    uintmax_t reg = v_toreg(ud, v_checkpoly(L, 2));
+    lua_Number nbytes = luaL_checknumber(L, 3);
+
+    luaL_argcheck(L, nbytes >= 0, 3, "nbytes must not be negative");
+
+    return v_pushreg(L, ud, ud->gf2().shift(reg, (uint64_t) nbytes));
+}
+
+/*-
+- r = crc:reflect(v, [bits])
+
+Returns the low bits of v in reverse order, where bits defaults to the crc's
+width.
+*/
+static int bcrc_reflect(lua_State *L)
+{
+    Crc* ud = checkudata(L);
+    uintmax_t v = v_checkpoly(L, 2);
+    int bits = luaL_optint(L, 3, ud->params().bits);
+
+    luaL_argcheck(L, bits > 0 && bits <= 64, 3, "bits must be 1..64");
+
+    lua_pushnumber(L, Gf2::reflect(v, bits));
+
+    return 1;
+}
+
+/*-
+- self = crc:copy(dst, dst_offset, src, [start, [, end]])
+
+Copy the substring of src from start..end into dst, starting at the
+zero-based byte offset dst_offset, and process the bytes into the crc as
+crc:process() would, reading them only once from memory.
+
+Src is a string, or a buffer from bcrc.buffer(). See crc:process() for the
+meaning of start and end.
+
+Dst is a buffer from bcrc.buffer(), or a light userdata. Only buffers are
+bounds checked, a light userdata must point to memory large enough for the
+copy.
+
+Returns the crc object.
+*/
+static int bcrc_copy(lua_State *L)
+{
+    Crc* ud = checkudata(L);
+    size_t dstsize = 0;
+    char* dst = v_tobuffer(L, 2, &dstsize);
+    lua_Number offset = luaL_checknumber(L, 3);
+    size_t size = 0;
+    const void* src = v_checksubstring(L, 4, &size);
+
+    if(!dst) {
+        luaL_argcheck(L, lua_islightuserdata(L, 2), 2, "buffer or light userdata expected");
+        dst = (char*) lua_touserdata(L, 2);
+        dstsize = (size_t) -1;
+        luaL_argcheck(L, dst, 2, "pointer is NULL");
+    }
+
+    luaL_argcheck(L, offset >= 0 && offset <= dstsize && size <= dstsize - (size_t) offset, 3,
+            "copy is out of bounds");
+
+    crc_copy(ud, dst + (size_t) offset, src, size);
+
+    lua_settop(L, 1);
+
+    return 1;
+}
+
+/*-
+- failures, bitmap = crc:verify_many(frames, [options])
+
+Verify the crc embedded in each of an array of frames (strings or buffers),
+in one call. Frames are checksummed several at a time by a table driven
+implementation of the crc's parameters, which leaves the crc itself
+untouched.
+
+Options is an optional table:
+
+  - crc_pos="tail"|"head", where the crc is in a frame, defaults to "tail"
+  - endian="big"|"little", the byte order of the crc, defaults to "little"
+    for crcs with reflect_remainder, otherwise "big"
+  - list=bool, whether to return a list of the failing frames, rather than a
+    bitmap, defaults to false
+  - into=array, an array from bcrc.array() to append the crc computed for
+    each frame to, that of no bytes for frames shorter than the crc,
+    defaults to none
+
+Returns the count of frames that failed, including those shorter than the
+crc, and a string with a bit for each frame, set if it failed: frame i is bit
+(i-1)%8 of byte (i-1)//8+1, counting from the lsb. With list=true, returns
+an array of the indices of the frames that failed instead.
+*/
+static int bcrc_verify_many(lua_State* L)
+{
+    Crc* ud = checkudata(L);
+    luaL_checktype(L, 2, LUA_TTABLE);
+    v_opttable(L, 3);
+
+    FrameCrc f = v_optframecrc(L, 3, ud);
+    bool list = v_optboolfield(L, 3, "list", false);
+    CrcArray* into = v_optintofield(L, 3, ud->params().bits);
+    std::size_t n = lua_objlen(L, 2);
+    size_t len;
+
+    for(std::size_t i = 1; i <= n; i++) {
+        lua_rawgeti(L, 2, i);
+        if(!v_tobuffer(L, -1, &len) && lua_type(L, -1) != LUA_TSTRING)
+            luaL_error(L, "frame %d is not a string or buffer", (int) i);
+        lua_pop(L, 1);
+    }
+
+    const CrcTable& table = ud->table();
+    std::vector<const unsigned char*> msg(n);
+    std::vector<std::size_t> msglen(n);
+    std::vector<uint64_t> sums(n);
+    std::vector<const unsigned char*> frames(n);
+    std::vector<std::size_t> frameslen(n);
+
+    for(std::size_t i = 0; i < n; i++) {
+        lua_rawgeti(L, 2, i + 1);
+        const char* frame = v_tobuffer(L, -1, &len);
+        if(!frame)
+            frame = lua_tolstring(L, -1, &len);
+        lua_pop(L, 1);
+
+        frames[i] = (const unsigned char*) frame;
+        frameslen[i] = len;
+        msg[i] = (const unsigned char*) f.payload(frame);
+        msglen[i] = len < f.size ? 0 : len - f.size;
+    }
+
+    if(n)
+        table.checksums(&msg[0], &msglen[0], n, &sums[0]);
+
+    v_appendinto(into, sums);
+
+    std::string bitmap(list ? 0 : (n + 7) / 8, '\0');
+    int failures = 0;
+
+    if(list)
+        lua_newtable(L);
+
+    for(std::size_t i = 0; i < n; i++) {
+        if(frameslen[i] >= f.size && sums[i] == f.get(f.at(frames[i], frameslen[i])))
+            continue;
+        failures++;
+        if(list) {
+            lua_pushinteger(L, i + 1);
+            lua_rawseti(L, -2, failures);
+        } else {
+            bitmap[i / 8] |= 1 << (i % 8);
+        }
+    }
+
+    lua_pushinteger(L, failures);
+    if(list)
+        lua_insert(L, -2);
+    else
+        lua_pushlstring(L, bitmap.data(), bitmap.size());
+
+    return 2;
+}
+
+static void v_shadowoff(lua_State* L, Crc* ud)
+{
+    if(ud->shadow)
+        luaL_unref(L, LUA_REGISTRYINDEX, ud->shadow->callback);
+    delete ud->shadow;
+    ud->shadow = NULL;
+}
+
+/*-
+- self = crc:shadow(n, [callback])
+
+Enable shadow verification of 1 in every n calls of crc:process() (or
+crc(bytes)): the bytes of the sampled calls are checksummed again by the
+bitwise boost::crc_basic reference implementation with the same parameters,
+starting from the crc's register before the call, and the result is compared
+with the crc's own checksum after it. This bounds the cost of cross-checking
+a fast implementation in production to about 1/n of the work.
+
+On a mismatch, callback(crc, expected, got) is called, where expected is the
+reference checksum, and got the crc's.
+
+An n of 0 disables shadow verification, and resets its counts.
+
+Returns the crc object.
+*/
+static int bcrc_shadow(lua_State *L)
+{
+    Crc* ud = checkudata(L);
+    lua_Number n = luaL_checknumber(L, 2);
+
+    luaL_argcheck(L, n >= 0, 2, "n must not be negative");
+    if(!lua_isnoneornil(L, 3))
+        luaL_checktype(L, 3, LUA_TFUNCTION);
+
+    v_shadowoff(L, ud);
+
+    if(n > 0) {
+        Crc* reference = crc_basic_new(ud->params());
+        luaL_argcheck(L, reference, 1, "no reference implementation for crc width");
+        lua_settop(L, 3);
+        int callback = lua_isnil(L, 3) ? LUA_NOREF : luaL_ref(L, LUA_REGISTRYINDEX);
+        ud->shadow = new CrcShadow((uint64_t) n, reference, callback);
+    }
+
+    lua_settop(L, 1);
+
+    return 1;
+}
+
+/*-
+- samples, mismatches = crc:shadow_stats()
+
+Returns the number of calls sampled by shadow verification, and how many of
+them mismatched.
+*/
+static int bcrc_shadow_stats(lua_State *L)
+{
+    Crc* ud = checkudata(L);
+
+    lua_pushnumber(L, ud->shadow ? ud->shadow->samples : 0);
+    lua_pushnumber(L, ud->shadow ? ud->shadow->mismatches : 0);
+
+    return 2;
+}
+
+static int bcrc_gc (lua_State *L)
+{
+    Crc** ud = (Crc**) luaL_checkudata(L, 1, L_CRC_REGID);
+    if(*ud)
+        v_shadowoff(L, *ud);
+    delete *ud;
+    *ud = NULL;
+    return 0;
+}
+
+/*
+Parse "host:port", where host is a numeric IPv4 address, or a numeric IPv6
+address in brackets, as in "[::1]:port".
+*/
+static void v_checksockaddr(lua_State* L, int narg, struct sockaddr_storage* ss, socklen_t* sslen)
+{
+    size_t len;
+    const char* addr = luaL_checklstring(L, narg, &len);
+    const char* colon = strrchr(addr, ':');
+    char host[INET6_ADDRSTRLEN + 2];
+    size_t hostlen = colon ? colon - addr : 0;
+    char* end = NULL;
+    long port = colon ? strtol(colon + 1, &end, 10) : -1;
+
+    if(!colon || end == colon + 1 || *end || port < 0 || port > 0xFFFF) {
+        luaL_argerror(L, narg, "address must be host:port");
+        return;
+    }
+    if(hostlen >= sizeof(host)) {
+        luaL_argerror(L, narg, "invalid host address");
+        return;
+    }
+
+    memcpy(host, addr, hostlen);
+    host[hostlen] = 0;
+
+    memset(ss, 0, sizeof(*ss));
+
+    if(hostlen >= 2 && host[0] == '[' && host[hostlen-1] == ']') {
+        struct sockaddr_in6* sin6 = (struct sockaddr_in6*) ss;
+        host[hostlen-1] = 0;
+        luaL_argcheck(L, inet_pton(AF_INET6, host + 1, &sin6->sin6_addr) == 1, narg, "invalid host address");
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_port = htons(port);
+        *sslen = sizeof(*sin6);
+    } else {
+        struct sockaddr_in* sin = (struct sockaddr_in*) ss;
+        luaL_argcheck(L, inet_pton(AF_INET, host, &sin->sin_addr) == 1, narg, "invalid host address");
+        sin->sin_family = AF_INET;
+        sin->sin_port = htons(port);
+        *sslen = sizeof(*sin);
+    }
+}
+
+static void v_pushsockaddr(lua_State* L, const struct sockaddr_storage* ss)
+{
+    char host[INET6_ADDRSTRLEN];
+
+    if(ss->ss_family == AF_INET6) {
+        const struct sockaddr_in6* sin6 = (const struct sockaddr_in6*) ss;
+        inet_ntop(AF_INET6, &sin6->sin6_addr, host, sizeof(host));
+        lua_pushfstring(L, "[%s]:%d", host, ntohs(sin6->sin6_port));
+    } else {
+        const struct sockaddr_in* sin = (const struct sockaddr_in*) ss;
+        inet_ntop(AF_INET, &sin->sin_addr, host, sizeof(host));
+        lua_pushfstring(L, "%s:%d", host, ntohs(sin->sin_port));
+    }
+}
+
+/*
+UDP socket receiving batches of frames with recvmmsg(), and verifying their
+embedded crc before any of them reach lua.
+*/
+class UdpValidator
+{
+    public:
+        int fd;
+        Crc* crc;
+        FrameCrc frame;
+        std::size_t size;
+        bool payloads;
+
+        uintmax_t received;
+        uintmax_t valid;
+        uintmax_t invalid;
+        uintmax_t truncated;
+
+        std::vector<unsigned char> rxbuf;
+        std::vector<struct iovec> rxiov;
+        std::vector<struct mmsghdr> rxmsgs;
+
+        std::vector<unsigned char> txcrc;
+        std::vector<struct iovec> txiov;
+        std::vector<struct mmsghdr> txmsgs;
+
+        UdpValidator(int fd_, Crc* crc_, const FrameCrc& frame_, unsigned batch, std::size_t size_, bool payloads_)
+            : fd(fd_), crc(crc_), frame(frame_), size(size_), payloads(payloads_),
+              received(0), valid(0), invalid(0), truncated(0),
+              rxbuf(batch * size_), rxiov(batch), rxmsgs(batch)
+        {
+            memset(&rxmsgs[0], 0, batch * sizeof(rxmsgs[0]));
+            for(unsigned i = 0; i < batch; i++) {
+                rxiov[i].iov_base = &rxbuf[i * size];
+                rxiov[i].iov_len = size;
+                rxmsgs[i].msg_hdr.msg_iov = &rxiov[i];
+                rxmsgs[i].msg_hdr.msg_iovlen = 1;
+            }
+        }
+
+        ~UdpValidator()
+        {
+            close(fd);
+            delete crc;
+        }
+};
+
+#define L_UDP_REGID "wt.bcrc.udp"
+
+/*-
+- validator = bcrc.udp_validator(bind_addr, [spec])
+
+Bind a UDP socket to bind_addr, a string "host:port" where host is a numeric
+IPv4 address, or an IPv6 address in brackets, such as "[::1]:0". Port 0
+binds an ephemeral port, see validator:address().
+
+Datagrams are received in batches, and the crc embedded in each is verified
+natively, so only the valid payloads are passed to lua.
+
+Spec is an optional table:
+
+  - crc=crc, a crc object to verify with, defaults to bcrc.crc32()
+  - crc_pos="tail"|"head", where the crc is in the datagram, defaults to "tail"
+  - endian="big"|"little", byte order of the crc, defaults to "little" if the
+    crc has reflect_remainder, otherwise "big"
+  - batch=n, maximum datagrams per validator:recv(), defaults to 64
+  - size=n, maximum datagram size, larger ones are invalid, defaults to 2048
+  - payloads=bool, whether validator:recv() returns payloads, or only
+    counts, defaults to true
+  - rcvbuf=n, socket receive buffer size, defaults to the system default
+
+Returns a validator object, or nil, errmsg, errno on failure.
+*/
+static int bcrc_udp_validator(lua_State* L)
+{
+    struct sockaddr_storage ss;
+    socklen_t sslen;
+
+    v_checksockaddr(L, 1, &ss, &sslen);
+    v_opttable(L, 2);
+
+    const Crc* crc = v_optcrcfield(L, 2);
+    FrameCrc frame = v_optframecrc(L, 2, crc);
+    lua_Integer batch = v_optintfield(L, 2, "batch", 64);
+    lua_Integer size = v_optintfield(L, 2, "size", 2048);
+    bool payloads = v_optboolfield(L, 2, "payloads", true);
+    lua_Integer rcvbuf = v_optintfield(L, 2, "rcvbuf", 0);
+
+    luaL_argcheck(L, batch > 0 && batch <= 1024, 2, "batch must be 1..1024");
+    luaL_argcheck(L, size > 0 && size <= 0xFFFF, 2, "size must be 1..65535");
+
+    int fd = socket(ss.ss_family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+
+    if(fd < 0)
+        return v_pusherror(L, errno);
+
+    if(rcvbuf > 0) {
+        int opt = rcvbuf;
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &opt, sizeof(opt));
+    }
+
+    if(bind(fd, (struct sockaddr*) &ss, sslen) < 0) {
+        int err = errno;
+        close(fd);
+        return v_pusherror(L, err);
+    }
+
+    UdpValidator** ud = v_newudata<UdpValidator>(L, L_UDP_REGID);
+    *ud = new UdpValidator(fd, crc->clone(), frame, batch, size, payloads);
+
+    return 1;
+}
+
+/*-
+- addr = validator:address()
+
+Returns the bound address, as "host:port".
+*/
+static int bcrc_udp_address(lua_State* L)
+{
+    UdpValidator* v = v_checkudata<UdpValidator>(L, 1, L_UDP_REGID);
+    struct sockaddr_storage ss;
+    socklen_t sslen = sizeof(ss);
+
+    if(getsockname(v->fd, (struct sockaddr*) &ss, &sslen) < 0)
+        return v_pusherror(L, errno);
+
+    v_pushsockaddr(L, &ss);
+
+    return 1;
+}
+
+/*-
+- payloads, invalid = validator:recv([timeout])
+
+Waits up to timeout milliseconds for datagrams, and receives up to a batch of
+them. If timeout is absent, waits until a datagram arrives. A timeout of 0
+doesn't wait.
+
+Returns an array of the valid payloads, with the crc removed, and a count of
+the invalid datagrams. If the spec's payloads was false, returns the counts of
+valid and invalid datagrams.
+
+On timeout, the array (or count) is empty.
+
+Returns nil, errmsg, errno on failure.
+*/
+static int bcrc_udp_recv(lua_State* L)
+{
+    UdpValidator* v = v_checkudata<UdpValidator>(L, 1, L_UDP_REGID);
+    int timeout = luaL_optint(L, 2, -1);
+    struct pollfd pfd = { v->fd, POLLIN, 0 };
+    int n = poll(&pfd, 1, timeout);
+
+    if(n > 0)
+        n = recvmmsg(v->fd, &v->rxmsgs[0], v->rxmsgs.size(), MSG_DONTWAIT, NULL);
+
+    if(n < 0) {
+        if(errno != EAGAIN && errno != EINTR)
+            return v_pusherror(L, errno);
+        n = 0;
+    }
+
+    int nvalid = 0;
+    int ninvalid = 0;
+
+    if(v->payloads)
+        lua_createtable(L, n, 0);
+
+    for(int i = 0; i < n; i++) {
+        const struct mmsghdr* m = &v->rxmsgs[i];
+        const unsigned char* frame = (const unsigned char*) v->rxiov[i].iov_base;
+
+        if(m->msg_hdr.msg_flags & MSG_TRUNC) {
+            v->truncated++;
+            ninvalid++;
+        } else if(v->frame.verify(v->crc, frame, m->msg_len)) {
+            nvalid++;
+            if(v->payloads) {
+                lua_pushlstring(L, (const char*) v->frame.payload(frame), m->msg_len - v->frame.size);
+                lua_rawseti(L, -2, nvalid);
+            }
+        } else {
+            ninvalid++;
+        }
+    }
+
+    v->received += n;
+    v->valid += nvalid;
+    v->invalid += ninvalid;
+
+    if(!v->payloads)
+        lua_pushinteger(L, nvalid);
+    lua_pushinteger(L, ninvalid);
+
+    return 2;
+}
+
+/*-
+- sent = validator:send(addr, payloads, [raw])
+
+Sends an array of payloads, strings, as datagrams to addr, a "host:port"
+string, in batches with sendmmsg(). The spec's crc is appended (or
+prepended) to each payload, unless raw is true, in which case the payloads
+are sent as-is.
+
+Returns the number of datagrams sent, or nil, errmsg, errno on failure.
+*/
+static int bcrc_udp_send(lua_State* L)
+{
+    UdpValidator* v = v_checkudata<UdpValidator>(L, 1, L_UDP_REGID);
+    struct sockaddr_storage ss;
+    socklen_t sslen;
+
+    v_checksockaddr(L, 2, &ss, &sslen);
+    luaL_checktype(L, 3, LUA_TTABLE);
+
+    bool raw = lua_toboolean(L, 4);
+    size_t n = lua_objlen(L, 3);
+    size_t parts = raw ? 1 : 2;
+
+    v->txcrc.resize(n * v->frame.size + 1);
+    v->txiov.resize(n * parts + 1);
+    v->txmsgs.resize(n + 1);
+
+    for(size_t i = 0; i < n; i++) {
+        size_t len;
+        lua_rawgeti(L, 3, i + 1);
+        if(lua_type(L, -1) != LUA_TSTRING)
+            return luaL_argerror(L, 3, "payloads must be strings");
+        /* not converted, so the string is still referenced by the payloads table */
+        const char* payload = lua_tolstring(L, -1, &len);
+        lua_pop(L, 1);
+
+        struct iovec* iov = &v->txiov[i * parts];
+        iov[0].iov_base = (void*) payload;
+        iov[0].iov_len = len;
+        if(!raw) {
+            unsigned char* crc = &v->txcrc[i * v->frame.size];
+            v->crc->reset();
+            v->crc->process_bytes(payload, len);
+            v->frame.put(crc, v->crc->checksum());
+            iov[1].iov_base = crc;
+            iov[1].iov_len = v->frame.size;
+            if(v->frame.head)
+                std::swap(iov[0], iov[1]);
+        }
+
+        struct msghdr* h = &v->txmsgs[i].msg_hdr;
+        memset(h, 0, sizeof(*h));
+        h->msg_name = &ss;
+        h->msg_namelen = sslen;
+        h->msg_iov = iov;
+        h->msg_iovlen = parts;
+    }
+
+    size_t sent = 0;
+
+    while(sent < n) {
+        unsigned batch = n - sent < 1024 ? n - sent : 1024;
+        int rc = sendmmsg(v->fd, &v->txmsgs[sent], batch, 0);
+        if(rc < 0) {
+            if(errno == EINTR)
+                continue;
+            return v_pusherror(L, errno);
+        }
+        sent += rc;
+    }
+
+    lua_pushinteger(L, sent);
+
+    return 1;
+}
+
+/*-
+- stats = validator:stats()
+
+Returns a table of counts since the validator was created:
+
+  - received, datagrams received
+  - valid, datagrams with a valid crc
+  - invalid, datagrams with an invalid crc, including truncated ones
+  - truncated, datagrams larger than the spec's size
+*/
+static int bcrc_udp_stats(lua_State* L)
+{
+    UdpValidator* v = v_checkudata<UdpValidator>(L, 1, L_UDP_REGID);
+
+    lua_createtable(L, 0, 4);
+    lua_pushnumber(L, v->received);
+    lua_setfield(L, -2, "received");
+    lua_pushnumber(L, v->valid);
+    lua_setfield(L, -2, "valid");
+    lua_pushnumber(L, v->invalid);
+    lua_setfield(L, -2, "invalid");
+    lua_pushnumber(L, v->truncated);
+    lua_setfield(L, -2, "truncated");
+
+    return 1;
+}
+
+/*-
+- validator:close()
+
+Closes the socket. The validator can't be used afterwards.
+*/
+static int bcrc_udp_gc(lua_State* L)
+{
+    return v_gcudata<UdpValidator>(L, L_UDP_REGID);
+}
+
+static const luaL_reg bcrc_udp_methods[] =
+{
+    {"address",      bcrc_udp_address},
+    {"recv",         bcrc_udp_recv},
+    {"send",         bcrc_udp_send},
+    {"stats",        bcrc_udp_stats},
+    {"close",        bcrc_udp_gc},
+    {"__gc",         bcrc_udp_gc},
+    {NULL, NULL}
+};
+
+/*-
+- checksums, failures, tail = bcrc.records(path_or_bytes, [options])
+
+Walk a stream of length-prefixed records, verifying (or computing) the crc of
+each one natively. Each record is laid out as:
+
+  length field | [crc] | header | payload | [crc]
+
+Path_or_bytes is the path of a file, which is mapped into memory, or if
+options has data=true, the bytes of the stream.
+
+Options is an optional table:
+
+  - length_field="u8"|"u16be"|"u16le"|"u32be"|"u32le"|"u64be"|"u64le", the
+    encoding of the payload length, defaults to "u32le"
+  - header=n, bytes of fixed size header between the length field and the
+    payload, not included in the length, defaults to 0
+  - skip=n, bytes at the start of the stream before the first record,
+    defaults to 0
+  - crc_at="tail"|"head"|"none", whether the crc follows the payload, follows
+    the length field, or is absent (the crcs are only computed), defaults
+    to "tail"
+  - cover_length=bool, whether the crc covers the length field as well as the
+    header and payload, defaults to false
+  - crc=crc, the crc object to use, defaults to bcrc.crc32()
+  - endian="big"|"little", byte order of the crc, defaults to "little" if the
+    crc has reflect_remainder, otherwise "big"
+  - data=bool, whether path_or_bytes is the bytes, defaults to false
+  - into=array, a bcrc.array() to append the computed crcs to
+
+Returns:
+
+  - checksums, a string of the computed crc of every record, each packed
+    big-endian in as many bytes as the crc is wide, or the into array
+  - failures, an array of the (zero-based) offsets of the records whose crc
+    didn't verify
+  - tail, the offset where the walk stopped, which is the size of the stream
+    unless the last record is incomplete
+
+Returns nil, errmsg, errno if the file can't be mapped.
+*/
+static int bcrc_records(lua_State* L)
+{
+    static const char* const lengths[] = {
+        "u8", "u16be", "u16le", "u32be", "u32le", "u64be", "u64le", NULL
+    };
+    static const char* const crc_at[] = { "tail", "head", "none", NULL };
+
+    luaL_checkstring(L, 1);
+    v_opttable(L, 2);
+
+    int length = v_optoptionfield(L, 2, "length_field", 4, lengths);
+    const Crc* crc = v_optcrcfield(L, 2);
+    lua_Integer header = v_optintfield(L, 2, "header", 0);
+    lua_Integer skip = v_optintfield(L, 2, "skip", 0);
+    RecordFormat f;
+
+    f.lenbytes = length == 0 ? 1 : (std::size_t) 2 << ((length - 1) / 2);
+    f.lenlittle = length > 0 && length % 2 == 0;
+    f.header = header;
+    f.crc_at = v_optoptionfield(L, 2, "crc_at", RecordFormat::CRC_TAIL, crc_at);
+    f.cover_length = v_optboolfield(L, 2, "cover_length", false);
+    f.frame = v_optframecrc(L, 2, crc);
+    CrcArray* into = v_optintofield(L, 2, crc->params().bits);
+
+    luaL_argcheck(L, skip >= 0 && header >= 0, 2, "skip and header must not be negative");
+
+    Mapping m;
+    int err = v_checkinput(L, 1, 2, &m);
+
+    if(err)
+        return v_pusherror(L, err);
+
+    Crc* c = crc->clone();
+    FrameCrc packed = { f.frame.size, false, false };
+    std::vector<unsigned char> checksums;
+    std::vector<std::size_t> failures;
+    std::size_t pos = (std::size_t) skip < m.size ? skip : m.size;
+
+    for(std::size_t size; (size = f.next(m.data + pos, m.size - pos)); pos += size) {
+        uintmax_t sum;
+        if(!f.check(c, m.data + pos, size, &sum))
+            failures.push_back(pos);
+        if(into) {
+            into->push(sum);
+            continue;
+        }
+        checksums.resize(checksums.size() + packed.size);
+        packed.put(&checksums[checksums.size() - packed.size], sum);
+    }
+
+    delete c;
+
+    if(into)
+        lua_getfield(L, 2, "into");
+    else
+        lua_pushlstring(L, checksums.empty() ? "" : (const char*) &checksums[0], checksums.size());
+    lua_createtable(L, failures.size(), 0);
+    for(std::size_t i = 0; i < failures.size(); i++) {
+        lua_pushnumber(L, failures[i]);
+        lua_rawseti(L, -2, i + 1);
+    }
+    lua_pushnumber(L, pos);
+
+    return 3;
+}
+
+/*
+Jump consistent hash, from "A Fast, Minimal Memory, Consistent Hash
+Algorithm", Lamping and Veach. Maps key to a bucket in [0, buckets), moving
+only 1/buckets of the keys when a bucket is added.
+*/
+static int32_t jump_consistent_hash(uint64_t key, int32_t buckets)
+{
+    int64_t b = -1;
+    int64_t j = 0;
+
+    while(j < buckets) {
+        b = j;
+        key = key * 2862933555777941757ULL + 1;
+        j = (b + 1) * ((double) (1LL << 31) / (double) ((key >> 33) + 1));
+    }
+
+    return (int32_t) b;
+}
+
+/*-
+- shards = bcrc.shard(keys, nshards, [params])
+
+Map each key of an array of string keys to one of nshards shards, using the
+crc of the key with jump consistent hashing. When nshards changes, only about
+1/nshards of the keys move to a different shard, unlike crc(key) % nshards.
+
+Params is an optional table:
+
+  - crc=crc, the crc object to use, defaults to bcrc.crc32()
+  - buckets=bool, defaults to false
+
+Returns an array of the shard of each key, numbered 1 to nshards. If buckets
+is true, instead returns an array of nshards arrays, each holding the keys
+mapped to that shard, in the order they occur in keys.
+*/
+static int bcrc_shard(lua_State* L)
+{
+    luaL_checktype(L, 1, LUA_TTABLE);
+    lua_Integer nshards = luaL_checkinteger(L, 2);
+    v_opttable(L, 3);
+
+    const Crc* crc = v_optcrcfield(L, 3);
+    bool buckets = v_optboolfield(L, 3, "buckets", false);
+    int nkeys = lua_objlen(L, 1);
+
+    luaL_argcheck(L, nshards > 0 && nshards <= 0x7FFFFFFF, 2, "nshards must be positive");
+
+    for(int i = 1; i <= nkeys; i++) {
+        lua_rawgeti(L, 1, i);
+        if(!lua_isstring(L, -1))
+            return luaL_argerror(L, 1, "keys must be strings");
+        lua_pop(L, 1);
+    }
+
+    lua_settop(L, 3);
+
+    if(buckets) {
+        lua_createtable(L, nshards, 0);
+        for(int i = 1; i <= nshards; i++) {
+            lua_newtable(L);
+            lua_rawseti(L, 4, i);
+        }
+    } else {
+        lua_createtable(L, nkeys, 0);
+    }
+
+    Crc* c = crc->clone();
+
+    for(int i = 1; i <= nkeys; i++) {
+        size_t len;
+        lua_rawgeti(L, 1, i);
+        const char* key = lua_tolstring(L, -1, &len);
+
+        c->reset();
+        c->process_bytes(key, len);
+
+        int shard = jump_consistent_hash(c->checksum(), nshards) + 1;
+
+        if(buckets) {
+            lua_rawgeti(L, 4, shard);
+            lua_insert(L, -2);
+            lua_rawseti(L, -2, lua_objlen(L, -2) + 1);
+            lua_pop(L, 1);
+        } else {
+            lua_pop(L, 1);
+            lua_pushinteger(L, shard);
+            lua_rawseti(L, 4, i);
+        }
+    }
+
+    delete c;
+
+    return 1;
+}
+
+#define L_RING_PRODUCER_REGID "wt.bcrc.ring_producer"
+
+/*-
+- producer = bcrc.ring_producer(shm_name, capacity)
+
+Create a ring in POSIX shared memory called shm_name, with a data area of
+capacity bytes, a power of two, and attach to it as its producer. If the
+ring already exists, it is re-initialized empty. See bcrc.ring_consumer() for
+the layout of the ring.
+
+This is mostly useful for testing consumers, and for creating the output ring
+of a consumer.
+
+Returns a producer object, or nil, errmsg, errno on failure.
+*/
+static int bcrc_ring_producer(lua_State* L)
+{
+    const char* name = luaL_checkstring(L, 1);
+    lua_Number capacity = luaL_checknumber(L, 2);
+    uint64_t cap = (uint64_t) capacity;
+
+    luaL_argcheck(L, capacity >= Ring::ALIGN && cap == capacity && !(cap & (cap - 1)), 2,
+            "capacity must be a power of two");
+
+    Ring* ring = NULL;
+    int err = Ring::open(name, cap, &ring);
+
+    if(err)
+        return v_pusherror(L, err);
+
+    Ring** ud = v_newudata<Ring>(L, L_RING_PRODUCER_REGID);
+    *ud = ring;
+
+    return 1;
+}
+
+/*-
+- ok = producer:push(frame)
+
+Append a frame to the ring.
+
+Returns true, or false if the ring is too full for the frame.
+*/
+static int bcrc_ring_push(lua_State* L)
+{
+    Ring* ring = v_checkudata<Ring>(L, 1, L_RING_PRODUCER_REGID);
+    size_t len;
+    const char* frame = luaL_checklstring(L, 2, &len);
+
+    luaL_argcheck(L, len < Ring::PAD, 2, "frame is too large");
+
+    lua_pushboolean(L, ring->push(frame, len));
+
+    return 1;
+}
+
+/*-
+- producer:close()
+
+Detach from the ring, it continues to exist in shared memory until it is
+unlinked with bcrc.ring_unlink().
+*/
+static int bcrc_ring_producer_gc(lua_State* L)
+{
+    return v_gcudata<Ring>(L, L_RING_PRODUCER_REGID);
+}
+
+static const luaL_reg bcrc_ring_producer_methods[] =
+{
+    {"push",         bcrc_ring_push},
+    {"close",        bcrc_ring_producer_gc},
+    {"__gc",         bcrc_ring_producer_gc},
+    {NULL, NULL}
+};
+
+/*-
+- ok = bcrc.ring_unlink(shm_name)
+
+Remove a ring from shared memory, processes attached to it may continue using
+it until they detach.
+
+Returns true, or nil, errmsg, errno on failure.
+*/
+static int bcrc_ring_unlink(lua_State* L)
+{
+    const char* name = luaL_checkstring(L, 1);
+
+    if(shm_unlink(name) < 0)
+        return v_pusherror(L, errno);
+
+    lua_pushboolean(L, 1);
+
+    return 1;
+}
+
+class RingConsumer
+{
+    public:
+        enum { VERIFY, COMPUTE, NONE };
+
+        Ring* in;
+        Ring* out;
+        Crc* crc;
+        FrameCrc frame;
+        int mode;
+
+        RingConsumer(Ring* in_, Ring* out_, Crc* crc_, const FrameCrc& frame_, int mode_)
+            : in(in_), out(out_), crc(crc_), frame(frame_), mode(mode_)
+        {
+        }
+
+        ~RingConsumer()
+        {
+            delete in;
+            delete out;
+            delete crc;
+        }
+};
+
+#define L_RING_CONSUMER_REGID "wt.bcrc.ring_consumer"
+
+/*-
+- consumer = bcrc.ring_consumer(shm_name, [spec])
+
+Attach as the consumer of a single-producer, single-consumer ring of frames
+in POSIX shared memory, created by another process, or by
+bcrc.ring_producer(). Frames are checksummed in place in the shared memory,
+they are never copied into lua strings.
+
+The ring is a shared memory object of a 192 byte header, followed by a data
+area of capacity bytes. All fields are in host byte order:
+
+    offset  size  field
+    0       4     magic, "BCRR"
+    4       4     version, 1
+    8       8     capacity, a power of two
+    64      8     head, total bytes ever written by the producer
+    128     8     tail, total bytes ever consumed by the consumer
+    192     -     data area
+
+Head and tail are only written by the producer and consumer respectively, each
+with release semantics, after writing or reading the frames they cover, and
+read by the other with acquire semantics.
+
+A frame starts at data area offset (head % capacity), and is a 4 byte
+length followed by the frame bytes, padded with unspecified bytes to a
+multiple of 8 bytes. A frame never wraps around the end of the data area.
+Instead, if it doesn't fit in the remaining space, a length of 0xFFFFFFFF is
+written to pad out the remaining space, and the frame is written at offset 0.
+
+Spec is an optional table:
+
+  - mode="verify"|"compute"|"none", whether frames have an embedded crc to be
+    verified, or the crc of the whole frame is to be computed, or frames are
+    only read with consumer:read(), defaults to "verify"
+  - crc=crc, the crc object to use, defaults to bcrc.crc32()
+  - crc_pos="tail"|"head", where the crc is in the frame, defaults to "tail"
+  - endian="big"|"little", byte order of the crc, defaults to "little" if the
+    crc has reflect_remainder, otherwise "big"
+  - output=shm_name, an existing ring to which results are published, in which
+    case the consumer is the producer of the output ring
+
+A result published to the output ring is a 16 byte frame of the crc (8
+bytes, 0 for frames shorter than the crc in verify mode), the frame length
+(4 bytes), and whether the crc was valid (4 bytes, 1 or 0, always 1 in
+compute mode), all in host byte order.
+
+Returns a consumer object, or nil, errmsg, errno on failure.
+*/
+static int bcrc_ring_consumer(lua_State* L)
+{
+    static const char* const modes[] = { "verify", "compute", "none", NULL };
+    const char* name = luaL_checkstring(L, 1);
+
+    v_opttable(L, 2);
+
+    const Crc* crc = v_optcrcfield(L, 2);
+    FrameCrc frame = v_optframecrc(L, 2, crc);
+    int mode = v_optoptionfield(L, 2, "mode", RingConsumer::VERIFY, modes);
+    const char* output = NULL;
+
+    if(lua_istable(L, 2)) {
+        lua_getfield(L, 2, "output");
+        luaL_argcheck(L, lua_isnil(L, -1) || lua_type(L, -1) == LUA_TSTRING, 2,
+                "output must be a ring name");
+        /* not converted, so the name is still referenced by the spec table */
+        output = lua_tostring(L, -1);
+        lua_pop(L, 1);
+    }
+
+    Ring* in = NULL;
+    Ring* out = NULL;
+    int err = Ring::open(name, 0, &in);
+
+    if(!err && output) {
+        err = Ring::open(output, 0, &out);
+        if(err)
+            delete in;
+    }
+
+    if(err)
+        return v_pusherror(L, err);
+
+    RingConsumer** ud = v_newudata<RingConsumer>(L, L_RING_CONSUMER_REGID);
+    *ud = new RingConsumer(in, out, crc->clone(), frame, mode);
+
+    return 1;
+}
+
+/*-
+- count, failures = consumer:poll([max])
+- crcs = consumer:poll([max])
+- count, nfailures = consumer:poll([max])
+
+Checksum up to max frames (all of the available frames if max is absent)
+and release them back to the producer.
+
+In verify mode, returns the count of frames, and an array of the indices
+(from 1 to count) of the frames whose crc didn't verify. In compute mode,
+returns an array of the crc of each frame.
+
+If the spec has an output ring, the results are published to it instead, and
+the counts of frames and failures are returned. Consuming stops early if the
+output ring is full.
+
+Returns nil, errmsg, errno (EBADMSG) if the ring is corrupt.
+*/
+static int bcrc_ring_poll(lua_State* L)
+{
+    RingConsumer* c = v_checkudata<RingConsumer>(L, 1, L_RING_CONSUMER_REGID);
+    lua_Number max = luaL_optnumber(L, 2, -1);
+    int count = 0;
+    int failures = 0;
+
+    luaL_argcheck(L, c->mode != RingConsumer::NONE, 1, "consumer is in mode none, use read()");
+
+    lua_settop(L, 2);
+    if(!c->out) {
+        lua_pushinteger(L, 0);
+        lua_newtable(L);
+    }
+
+    for(uint32_t len; (max < 0 || count < max); count++) {
+        const unsigned char* f = c->in->front(&len);
+        uintmax_t sum;
+        bool valid = true;
+
+        if(!f)
+            break;
+
+        if(c->mode == RingConsumer::VERIFY) {
+            valid = c->frame.verify(c->crc, f, len);
+            /* frames shorter than the crc aren't checksummed */
+            sum = len < c->frame.size ? 0 : c->crc->checksum();
+        } else {
+            c->crc->reset();
+            c->crc->process_bytes(f, len);
+            sum = c->crc->checksum();
+        }
+
+        if(c->out) {
+            unsigned char result[16];
+            uint64_t sum64 = sum;
+            uint32_t ok = valid;
+            memcpy(result, &sum64, 8);
+            memcpy(result + 8, &len, 4);
+            memcpy(result + 12, &ok, 4);
+            if(!c->out->push(result, sizeof(result)))
+                break;
+        } else if(c->mode == RingConsumer::COMPUTE) {
+            lua_pushnumber(L, sum);
+            lua_rawseti(L, 4, count + 1);
+        } else if(!valid) {
+            lua_pushinteger(L, count + 1);
+            lua_rawseti(L, 4, failures + 1);
+        }
+
+        failures += !valid;
+        c->in->pop(len);
+    }
+
+    c->in->advance();
+
+    if(c->in->corrupt)
+        return v_pusherror(L, EBADMSG);
+
+    if(c->out) {
+        lua_pushinteger(L, count);
+        lua_pushinteger(L, failures);
+        return 2;
+    }
+
+    if(c->mode == RingConsumer::COMPUTE)
+        return 1;
+
+    lua_pushinteger(L, count);
+    lua_replace(L, 3);
+
+    return 2;
+}
+
+/*-
+- frames = consumer:read([max])
+
+Copy up to max frames (all of the available frames if max is absent) out of
+the ring into lua strings, without checksumming them, and release them back to
+the producer. Useful for reading an output ring.
+
+Returns an array of frames, or nil, errmsg, errno (EBADMSG) if the ring is
+corrupt.
+*/
+static int bcrc_ring_read(lua_State* L)
+{
+    RingConsumer* c = v_checkudata<RingConsumer>(L, 1, L_RING_CONSUMER_REGID);
+    lua_Number max = luaL_optnumber(L, 2, -1);
+    int count = 0;
+
+    lua_newtable(L);
+
+    for(uint32_t len; (max < 0 || count < max); count++) {
+        const unsigned char* f = c->in->front(&len);
+        if(!f)
+            break;
+        lua_pushlstring(L, (const char*) f, len);
+        lua_rawseti(L, -2, count + 1);
+        c->in->pop(len);
+    }
+
+    c->in->advance();
+
+    if(c->in->corrupt)
+        return v_pusherror(L, EBADMSG);
+
+    return 1;
+}
+
+/*-
+- consumer:close()
+
+Detach from the ring(s).
+*/
+static int bcrc_ring_consumer_gc(lua_State* L)
+{
+    return v_gcudata<RingConsumer>(L, L_RING_CONSUMER_REGID);
+}
+
+static const luaL_reg bcrc_ring_consumer_methods[] =
+{
+    {"poll",         bcrc_ring_poll},
+    {"read",         bcrc_ring_read},
+    {"close",        bcrc_ring_consumer_gc},
+    {"__gc",         bcrc_ring_consumer_gc},
+    {NULL, NULL}
+};
+
+/*
+Protection information for a run of sectors, generated or verified in
+parallel.
+*/
+struct T10Job
+{
+    T10Dif dif;
+    const unsigned char* data;
+    std::size_t sector;
+    /* bytes from one sector to the next in data */
+    std::size_t stride;
+    /* PI tuples, 8 bytes per sector */
+    const unsigned char* pi;
+    uint32_t ref;
+    uint16_t app;
+    bool check_ref;
+    /* generate: output image, and its stride */
+    unsigned char* out;
+    std::size_t outstride;
+    /* verify: whether each sector failed */
+    std::vector<unsigned char> bad;
+    /* the guard tag of each sector, if wanted */
+    std::vector<uint16_t> guards;
+
+    static void put16(unsigned char* p, uint16_t v)
+    {
+        p[0] = v >> 8;
+        p[1] = v;
+    }
+
+    static void put32(unsigned char* p, uint32_t v)
+    {
+        put16(p, v >> 16);
+        put16(p + 2, v);
+    }
+
+    static void generate(void* ctx, std::size_t begin, std::size_t end)
+    {
+        T10Job* job = (T10Job*) ctx;
+
+        for(std::size_t i = begin; i < end; i++) {
+            const unsigned char* s = job->data + i * job->stride;
+            unsigned char* o = job->out + i * job->outstride;
+            if(job->outstride > 8) {
+                memcpy(o, s, job->sector);
+                o += job->sector;
+            }
+            uint16_t guard = job->dif(s, job->sector);
+            if(!job->guards.empty())
+                job->guards[i] = guard;
+            put16(o, guard);
+            put16(o + 2, job->app);
+            put32(o + 4, job->ref + i);
+        }
+    }
+
+    static void verify(void* ctx, std::size_t begin, std::size_t end)
+    {
+        T10Job* job = (T10Job*) ctx;
+        FrameCrc be16 = { 2, false, false };
+        FrameCrc be32 = { 4, false, false };
+
+        for(std::size_t i = begin; i < end; i++) {
+            const unsigned char* s = job->data + i * job->stride;
+            const unsigned char* pi = job->pi ? job->pi + 8 * i : s + job->sector;
+            bool skip = be16.get(pi + 2) == 0xFFFF;
+            if(skip && job->guards.empty())
+                continue;
+            uint16_t guard = job->dif(s, job->sector);
+            if(!job->guards.empty())
+                job->guards[i] = guard;
+            job->bad[i] = !skip && (be16.get(pi) != guard
+                || (job->check_ref && be32.get(pi + 4) != (uint32_t) (job->ref + i)));
+        }
+    }
+};
+
+/*-
+- pi = bcrc.t10pi(path_or_bytes, {mode="generate", ...})
+- failures = bcrc.t10pi(path_or_bytes, {mode="verify", ...})
+
+Generate or verify T10 protection information (PI) for a disk image, in
+parallel across cores. Each sector's 8 byte PI tuple is a CRC-16/T10-DIF guard
+tag of the sector (see bcrc.t10dif()), a 2 byte application tag, and a 4 byte
+reference tag, all big-endian. The reference tag is the low 32 bits of the
+sector's LBA (as for Type 1 protection).
+
+Path_or_bytes is the path of an image file, which is mapped into memory, or
+if the options has data=true, the bytes of the image. A partial sector at
+the end of the image is ignored.
+
+Options:
+
+  - mode="generate"|"verify", defaults to "generate"
+  - sector=n, bytes of data per sector, usually 512 or 4096, defaults to 512
+  - ref_tag_start=n, the reference tag of the first sector, defaults to 0
+  - app_tag=n, the application tag to generate, defaults to 0
+  - interleaved=bool, when generating, whether to return the image with PI
+    following each sector (for example, 520 byte sectors), instead of only
+    the PI, defaults to false
+  - pi=bytes, when verifying, the PI tuples of the sectors, a string or
+    buffer, if absent the image is interleaved, PI following each sector
+  - check_ref=bool, when verifying, whether to check reference tags,
+    defaults to true
+  - threads=n, defaults to the number of online CPUs
+  - data=bool, whether path_or_bytes is the bytes, defaults to false
+  - into=array, an array from bcrc.array() to append the guard tag computed
+    for each sector to, defaults to none
+
+When generating, returns the PI tuples of the sectors, or the interleaved
+image.
+
+When verifying, returns an array of the (zero-based) indices of the sectors
+whose guard or reference tag didn't verify. Sectors with an application tag
+of 0xFFFF are not checked.
+
+Returns nil, errmsg, errno if the file can't be mapped.
+*/
+static int bcrc_t10pi(lua_State* L)
+{
+    static const char* const modes[] = { "generate", "verify", NULL };
+
+    luaL_checkstring(L, 1);
+    v_opttable(L, 2);
+
+    bool verify = v_optoptionfield(L, 2, "mode", 0, modes) == 1;
+    lua_Integer sector = v_optintfield(L, 2, "sector", 512);
+    lua_Number ref = v_optintfield(L, 2, "ref_tag_start", 0);
+    lua_Integer app = v_optintfield(L, 2, "app_tag", 0);
+    bool interleaved = v_optboolfield(L, 2, "interleaved", false);
+    bool check_ref = v_optboolfield(L, 2, "check_ref", true);
+    lua_Integer threads = v_optintfield(L, 2, "threads", online_cpus());
+    CrcArray* into = v_optintofield(L, 2, 16);
+    size_t pisize = 0;
+    const char* pi = NULL;
+
+    if(verify && lua_istable(L, 2)) {
+        lua_getfield(L, 2, "pi");
+        pi = v_tobuffer(L, -1, &pisize);
+        if(!pi && !lua_isnil(L, -1)) {
+            if(lua_type(L, -1) != LUA_TSTRING)
+                return luaL_argerror(L, 2, "pi must be a string or buffer");
+            pi = lua_tolstring(L, -1, &pisize);
+        }
+        /* not converted, so the pi is still referenced by the options table */
+        lua_pop(L, 1);
+    }
+
+    luaL_argcheck(L, sector > 0, 2, "sector must be positive");
+    luaL_argcheck(L, threads > 0, 2, "threads must be positive");
+
+    Mapping m;
+    int err = v_checkinput(L, 1, 2, &m);
+
+    if(err)
+        return v_pusherror(L, err);
+
+    T10Job job;
+    job.data = m.data;
+    job.sector = sector;
+    job.stride = verify && !pi ? sector + 8 : sector;
+    job.pi = (const unsigned char*) pi;
+    job.ref = (uint32_t) (int64_t) ref;
+    job.app = app;
+    job.check_ref = check_ref;
+    job.out = NULL;
+    job.outstride = interleaved ? sector + 8 : 8;
+
+    std::size_t n = m.size / job.stride;
+
+    if(pi && pisize / 8 < n)
+        n = pisize / 8;
+
+    if(into)
+        job.guards.resize(n);
+
+    if(!verify) {
+        std::vector<unsigned char> out(n * job.outstride + 1);
+        job.out = &out[0];
+        parallel_for(n, threads, T10Job::generate, &job);
+        v_appendinto(into, job.guards);
+        lua_pushlstring(L, (const char*) job.out, n * job.outstride);
+        return 1;
+    }
+
+    job.bad.resize(n);
+    parallel_for(n, threads, T10Job::verify, &job);
+    v_appendinto(into, job.guards);
+
+    lua_newtable(L);
+    for(std::size_t i = 0, nbad = 0; i < n; i++) {
+        if(job.bad[i]) {
+            lua_pushnumber(L, i);
+            lua_rawseti(L, -2, ++nbad);
+        }
+    }
+
+    return 1;
+}
+
+static void v_pushdeltacopy(lua_State* L, std::size_t offset, std::size_t length, int n)
+{
+    lua_createtable(L, 2, 0);
+    lua_pushnumber(L, offset);
+    lua_rawseti(L, -2, 1);
+    lua_pushnumber(L, length);
+    lua_rawseti(L, -2, 2);
+    lua_rawseti(L, -2, n);
+}
+
+/*-
+- ops, matched = bcrc.delta(old, new, block_size, [options])
+
+Compute the delta between two files, as rsync does: the crc of each
+block_size block of old is indexed, and a rolling crc is slid over new a byte
+at a time, looking for blocks of old at any offset in new. Regions of new are
+scanned in parallel.
+
+Old and new are paths of files, which are mapped into memory, or if options
+has data=true, the bytes of the files.
+
+Options is an optional table:
+
+  - threads=n, defaults to the number of online CPUs
+  - data=bool, whether old and new are the bytes, defaults to false
+
+Returns an array of instructions that rebuild new from old, in order. Each
+instruction is either a table {offset, length} to copy length bytes from the
+(zero-based) offset in old, or a string of literal bytes. Also returns the
+count of bytes of new that were matched in old.
+
+Matched blocks are compared byte by byte, so the delta is exact even if crcs
+collide.
+
+Returns nil, errmsg, errno if a file can't be mapped.
+*/
+static int bcrc_delta(lua_State* L)
+{
+    luaL_checkstring(L, 1);
+    luaL_checkstring(L, 2);
+    lua_Integer bs = luaL_checkinteger(L, 3);
+    v_opttable(L, 4);
+
+    lua_Integer threads = v_optintfield(L, 4, "threads", online_cpus());
+
+    luaL_argcheck(L, bs > 0, 3, "block_size must be positive");
+    luaL_argcheck(L, threads > 0, 4, "threads must be positive");
+
+    Mapping old;
+    Mapping new_;
+    int err = v_checkinput(L, 1, 4, &old);
+
+    if(!err)
+        err = v_checkinput(L, 2, 4, &new_);
+
+    if(err)
+        return v_pusherror(L, err);
+
+    RollingCrc roller(bs);
+    DeltaJob job;
+
+    job.old = old.data;
+    job.new_ = new_.data;
+    job.newsize = new_.size;
+    job.bs = bs;
+    job.roller = &roller;
+    job.index(old.size / bs);
+
+    /* regions of at least 64 blocks, and a few per thread to balance the load */
+    job.nregions = 0;
+    if(new_.size >= (std::size_t) bs && old.size >= (std::size_t) bs) {
+        job.nregions = new_.size / (64 * bs) + 1;
+        if(job.nregions > 4 * (std::size_t) threads)
+            job.nregions = 4 * threads;
+    }
+    job.matches.resize(job.nregions);
+
+    parallel_for(job.nregions, threads, DeltaJob::scan, &job);
+    job.merge();
+
+    std::size_t pos = 0;
+    std::size_t matched = 0;
+    int n = 0;
+
+    lua_newtable(L);
+
+    for(std::size_t i = 0; i < job.copies.size(); i++) {
+        const DeltaJob::Copy& c = job.copies[i];
+
+        if(c.at > pos) {
+            lua_pushlstring(L, (const char*) new_.data + pos, c.at - pos);
+            lua_rawseti(L, -2, ++n);
+        }
+        v_pushdeltacopy(L, c.offset, c.length, ++n);
+        matched += c.length;
+        pos = c.at + c.length;
+    }
+
+    if(pos < new_.size) {
+        lua_pushlstring(L, (const char*) new_.data + pos, new_.size - pos);
+        lua_rawseti(L, -2, ++n);
+    }
+
+    lua_pushnumber(L, matched);
+
+    return 2;
+}
+
+/*-
+- buffer = bcrc.buffer(size)
+
+Create a fixed size buffer of zero bytes, that can be the destination of
+crc:copy(), and used in place of a string by crc:process() and crc(). Its
+length is #buffer.
+*/
+static int bcrc_buffer(lua_State* L)
+{
+    lua_Number size = luaL_checknumber(L, 1);
+
+    luaL_argcheck(L, size >= 0, 1, "size must not be negative");
+
+    void* b = lua_newuserdata(L, (size_t) size);
+    memset(b, 0, (size_t) size);
+
+    luaL_getmetatable(L, L_BUFFER_REGID);
+    lua_setmetatable(L, -2);
+
+    return 1;
+}
+
+/*-
+- bytes = buffer:tostring([start, [, end]])
+
+Returns the substring of the buffer from start..end, see crc:process() for
+their default values.
+*/
+static int bcrc_buffer_tostring(lua_State* L)
+{
+    size_t size;
+
+    luaL_checkudata(L, 1, L_BUFFER_REGID);
+
+    const char* bytes = v_checksubstring(L, 1, &size);
+
+    lua_pushlstring(L, bytes, size);
+
+    return 1;
+}
+
+static int bcrc_buffer_len(lua_State* L)
+{
+    luaL_checkudata(L, 1, L_BUFFER_REGID);
+    lua_pushinteger(L, lua_objlen(L, 1));
+    return 1;
+}
+
+static const luaL_reg bcrc_buffer_methods[] =
+{
+    {"tostring",     bcrc_buffer_tostring},
+    {"__len",        bcrc_buffer_len},
+    {NULL, NULL}
+};
+
+#define L_PRBS_REGID "wt.bcrc.prbs"
+
+/*-
+- prbs = bcrc.prbs(order, [options])
+
+Create a generator and checker of a pseudo-random binary sequence, as used to
+test links. Order is 7, 9, 11, 15, 20, 23 or 31 for the ITU-T O.150
+sequences PRBS7 (x^7 + x^6 + 1), PRBS9 (x^9 + x^5 + 1), PRBS11 (x^11 + x^9 +
+1), PRBS15 (x^15 + x^14 + 1), PRBS20 (x^20 + x^3 + 1), PRBS23 (x^23 + x^18 +
+1) or PRBS31 (x^31 + x^28 + 1), or up to 64 if a polynomial is given.
+
+Bit i of the sequence is the xor of bits i-j for each term x^j of the
+polynomial, other than 1. Bits are packed into bytes first bit in the msb.
+
+Options is an optional table:
+
+  - poly=number, the polynomial without its x^order term, as for bcrc.new(),
+    so PRBS7 is 0x41
+  - seed=number, the first order bits of the generator, defaults to all ones
+  - invert=bool, whether the bits are inverted, as O.150 specifies for PRBS15,
+    PRBS23 and PRBS31, defaults to false
+*/
+static int bcrc_prbs(lua_State* L)
+{
+    static const struct { unsigned order; uint64_t poly; } standard[] = {
+        {7, 0x41}, {9, 0x21}, {11, 0x201}, {15, 0x4001}, {20, 0x9},
+        {23, 0x40001}, {31, 0x10000001}
+    };
+    lua_Integer order = luaL_checkinteger(L, 1);
+    v_opttable(L, 2);
+
+    lua_Number poly = -1;
+    bool invert = v_optboolfield(L, 2, "invert", false);
+
+    for(std::size_t i = 0; i < sizeof(standard) / sizeof(standard[0]); i++) {
+        if(standard[i].order == order)
+            poly = standard[i].poly;
+    }
+
+    poly = v_optnumberfield(L, 2, "poly", poly);
+
+    lua_Number seed = v_optnumberfield(L, 2, "seed", -1);
+
+    luaL_argcheck(L, order >= 2 && order <= 64, 1, "order must be from 2 to 64");
+    luaL_argcheck(L, poly >= 0, 2, "poly is required for a non-standard order");
+
+    Prbs** ud = v_newudata<Prbs>(L, L_PRBS_REGID);
+    *ud = new Prbs(order, (uint64_t) poly, seed < 0 ? ~(uint64_t) 0 : (uint64_t) seed, invert);
+
+    return 1;
+}
+
+/*-
+- bytes = prbs:generate(n)
+
+Returns the next n bytes of the sequence.
+*/
+static int bcrc_prbs_generate(lua_State* L)
+{
+    Prbs* prbs = v_checkudata<Prbs>(L, 1, L_PRBS_REGID);
+    lua_Number n = luaL_checknumber(L, 2);
+
+    luaL_argcheck(L, n >= 0, 2, "n must not be negative");
+
+    luaL_Buffer b;
+    luaL_buffinit(L, &b);
+
+    for(std::size_t left = (std::size_t) n; left; ) {
+        std::size_t chunk = left < LUAL_BUFFERSIZE ? left : LUAL_BUFFERSIZE;
+        prbs->generate((unsigned char*) luaL_prepbuffer(&b), chunk);
+        luaL_addsize(&b, chunk);
+        left -= chunk;
+    }
+
+    luaL_pushresult(&b);
+
+    return 1;
+}
+
+/*-
+- errors, bits = prbs:check(bytes, [start, [, end]])
+
+Check the substring of bytes (a string or buffer) from start..end, see
+crc:process(), against the sequence. The checker synchronizes to the first
+bytes it receives, as many as the order needs, which aren't checked. After
+that it runs freely, so each bit error is counted once, and bytes received
+by successive calls continue the sequence.
+
+Returns the count of bit errors, and of bits checked.
+*/
+static int bcrc_prbs_check(lua_State* L)
+{
+    Prbs* prbs = v_checkudata<Prbs>(L, 1, L_PRBS_REGID);
+    size_t size;
+    const char* bytes = v_checksubstring(L, 2, &size);
+    uint64_t bits;
+    uint64_t errors = prbs->check((const unsigned char*) bytes, size, &bits);
+
+    lua_pushnumber(L, errors);
+    lua_pushnumber(L, bits);
+
+    return 2;
+}
+
+/*-
+- prbs:sync()
+
+Resynchronize the checker to the next bytes it receives, after a slip of the
+received sequence.
+*/
+static int bcrc_prbs_sync(lua_State* L)
+{
+    v_checkudata<Prbs>(L, 1, L_PRBS_REGID)->sync();
+    return 0;
+}
+
+static int bcrc_prbs_gc(lua_State* L)
+{
+    return v_gcudata<Prbs>(L, L_PRBS_REGID);
+}
+
+static const luaL_reg bcrc_prbs_methods[] =
+{
+    {"generate",     bcrc_prbs_generate},
+    {"check",        bcrc_prbs_check},
+    {"sync",         bcrc_prbs_sync},
+    {"__gc",         bcrc_prbs_gc},
+    {NULL, NULL}
+};
+
+/*-
+- image = bcrc.firmware.load(path, [options])
+
+Load a firmware image from a file of Intel HEX or Motorola S-records,
+verifying the checksum of every record, and compute a crc of the image.
+
+Options is an optional table:
+
+  - crc=bcrc, the crc of the image, defaults to bcrc.crc32()
+  - ranges={{address, length}, ...}, the ranges of addresses the crc covers,
+    in order, defaults to the whole image, from its lowest address to its
+    highest
+  - fill=byte, the value of the bytes in the ranges that aren't in the
+    image, defaults to 0xFF, as of erased flash
+  - data=bool, whether path is the records, rather than the path of a file of
+    them, defaults to false
+
+The crc of a gap is computed in time logarithmic in its size, so ranges
+covering sparse images (and the whole of a flash device) are cheap.
+
+Returns a table:
+
+  - segments={{address, bytes}, ...}, the contiguous runs of bytes of the
+    image, in order of address
+  - start=address, the start address of the image, if it has one
+  - crc=number, the crc of the ranges
+
+Returns nil, errmsg, errno if the file can't be mapped, or nil, errmsg,
+line if a record is invalid.
+*/
+static int bcrc_firmware_load(lua_State* L)
+{
+    luaL_checkstring(L, 1);
+    v_opttable(L, 2);
+
+    const Crc* crc = v_optcrcfield(L, 2);
+    lua_Integer fill = v_optintfield(L, 2, "fill", 0xFF);
+    std::vector<uint64_t> ranges;
+
+    luaL_argcheck(L, fill >= 0 && fill <= 0xFF, 2, "fill must be a byte");
+
+    if(lua_istable(L, 2)) {
+        lua_getfield(L, 2, "ranges");
+        if(!lua_isnil(L, -1)) {
+            luaL_argcheck(L, lua_istable(L, -1), 2, "ranges must be a table");
+            for(int i = 1; ; i++) {
+                lua_rawgeti(L, -1, i);
+                if(lua_isnil(L, -1)) {
+                    lua_pop(L, 1);
+                    break;
+                }
+                luaL_argcheck(L, lua_istable(L, -1), 2, "each range must be {address, length}");
+                for(int k = 1; k <= 2; k++) {
+                    lua_rawgeti(L, -1, k);
+                    luaL_argcheck(L, lua_isnumber(L, -1) && lua_tonumber(L, -1) >= 0, 2,
+                            "each range must be {address, length}");
+                    ranges.push_back((uint64_t) lua_tonumber(L, -1));
+                    lua_pop(L, 1);
+                }
+                lua_pop(L, 1);
+            }
+        }
+        lua_pop(L, 1);
+    }
+
+    Mapping m;
+    int err = v_checkinput(L, 1, 2, &m);
+
+    if(err)
+        return v_pusherror(L, err);
+
+    Firmware fw;
+
+    if(!fw.parse(m.data, m.size)) {
+        lua_pushnil(L);
+        lua_pushfstring(L, "line %d: %s", (int) fw.line, fw.error);
+        lua_pushinteger(L, fw.line);
+        return 3;
+    }
+
+    if(ranges.empty()) {
+        if(!fw.segments.empty()) {
+            ranges.push_back(fw.segments.front().address);
+            ranges.push_back(fw.segments.back().end() - fw.segments.front().address);
+        }
+    }
+
+    Crc* c = crc->clone();
+
+    c->reset();
+    for(std::size_t i = 0; i < ranges.size(); i += 2) {
+        fw.process(c, ranges[i], ranges[i + 1], fill);
+    }
+
+    lua_createtable(L, 0, 3);
+
+    lua_createtable(L, fw.segments.size(), 0);
+    for(std::size_t i = 0; i < fw.segments.size(); i++) {
+        const Firmware::Segment& seg = fw.segments[i];
+        lua_createtable(L, 2, 0);
+        lua_pushnumber(L, seg.address);
+        lua_rawseti(L, -2, 1);
+        lua_pushlstring(L, seg.bytes.data(), seg.bytes.size());
+        lua_rawseti(L, -2, 2);
+        lua_rawseti(L, -2, i + 1);
+    }
+    lua_setfield(L, -2, "segments");
+
+    if(fw.has_start) {
+        lua_pushnumber(L, fw.start);
+        lua_setfield(L, -2, "start");
+    }
+
+    lua_pushnumber(L, c->checksum());
+    lua_setfield(L, -2, "crc");
+
+    delete c;
+
+    return 1;
+}
+
+static const luaL_reg bcrc_firmware[] =
+{
+    {"load",         bcrc_firmware_load},
+    {NULL, NULL}
+};
+
+/* A file descriptor, either an integer, or an io library file, which is flushed. */
+static int v_checkfd(lua_State* L, int narg)
+{
+    if(lua_isnumber(L, narg))
+        return lua_tointeger(L, narg);
+
+    FILE** f = (FILE**) luaL_checkudata(L, narg, LUA_FILEHANDLE);
+
+    luaL_argcheck(L, *f, narg, "file is closed");
+    fflush(*f);
+
+    return fileno(*f);
+}
+
+/*-
+- bytes, checksum = bcrc.relay(in, out, crc, [options])
+
+Move bytes from in to out, processing them into crc as crc:process() would,
+until the end of in. In and out are file descriptors (integers), or files of
+the io library (which are flushed first, don't read from in with the io
+library as well, it buffers ahead).
+
+The bytes are copied as little as possible: from a regular file they are
+mapped and sent with sendfile(), from a pipe they are duplicated with tee()
+for the crc, and moved with splice(), otherwise they are read into a buffer
+and written from it.
+
+Options is an optional table:
+
+  - len=number, the most bytes to move, defaults to all of them
+
+Returns the count of bytes moved, and the checksum. Returns nil, errmsg,
+errno on failure, in which case some bytes may have been moved and
+processed.
+*/
+static int bcrc_relay(lua_State* L)
+{
+    int in = v_checkfd(L, 1);
+    int out = v_checkfd(L, 2);
+    Crc* crc = checkudata(L, 3);
+    v_opttable(L, 4);
+
+    lua_Number len = v_optnumberfield(L, 4, "len", -1);
+    Relay relay(in, out, crc);
+
+    int err = relay.run(len < 0 ? (uint64_t) -1 : (uint64_t) len);
+
+    if(err)
+        return v_pusherror(L, err);
+
+    lua_pushnumber(L, relay.moved);
+    lua_pushnumber(L, crc->checksum());
+
+    return 2;
+}
+
+#define L_CHUNKER_REGID "wt.bcrc.chunker"
+
+/*-
+- chunker = bcrc.chunker([options])
+
+Create a content defined chunker, for deduplicating storage. A stream fed to
+the chunker is cut into chunks where the crc of the last window bytes has
+its low bits zero, so the cuts depend on the content around them, and an
+insertion or deletion only changes the chunks near it. Each chunk has a
+fingerprint, a crc of its bytes.
+
+Options is an optional table:
+
+  - min=n, the least bytes in a chunk (other than the last), defaults to 2048
+  - avg=n, the average bytes in a chunk, defaults to 8192
+  - max=n, the most bytes in a chunk, defaults to 65536
+  - window=n, the bytes the rolling crc covers, defaults to 48
+  - crc=bcrc, the crc of the fingerprints, defaults to CRC-64/XZ, of
+    polynomial 0x42F0E1EBA9EA3693, reflected, with initial and xor values of
+    all ones
+  - threads=n, the threads scanning large inputs, defaults to the number of
+    online CPUs
+
+A chunk of more than min bytes is cut with a probability of 1 in the power
+of two nearest to avg-min at each byte, so the average size is about avg,
+and always at max.
+*/
+static int bcrc_chunker(lua_State* L)
+{
+    v_opttable(L, 1);
+
+    lua_Integer min = v_optintfield(L, 1, "min", 2048);
+    lua_Integer avg = v_optintfield(L, 1, "avg", 8192);
+    lua_Integer max = v_optintfield(L, 1, "max", 65536);
+    lua_Integer window = v_optintfield(L, 1, "window", 48);
+    lua_Integer threads = v_optintfield(L, 1, "threads", online_cpus());
+    CrcParams p = { 64, 0x42F0E1EBA9EA3693ULL, ~(uintmax_t) 0, ~(uintmax_t) 0, true, true };
+
+    luaL_argcheck(L, min >= 1 && min <= avg && avg <= max, 1, "must have 1 <= min <= avg <= max");
+    luaL_argcheck(L, window >= 1 && window <= 4096, 1, "window must be 1 to 4096");
+    luaL_argcheck(L, threads > 0, 1, "threads must be positive");
+
+    if(lua_istable(L, 1)) {
+        lua_getfield(L, 1, "crc");
+        if(!lua_isnil(L, -1))
+            p = v_optcrcfield(L, 1)->params();
+        lua_pop(L, 1);
+    }
+
+    /* 2^bits nearest to avg - min */
+    unsigned bits = 0;
+    while(bits < 31 && (3u << bits) / 2 < (uint64_t) (avg - min))
+        bits++;
+
+    Chunker** ud = v_newudata<Chunker>(L, L_CHUNKER_REGID);
+    *ud = new Chunker(window, min, max, ((uint32_t) 1 << bits) - 1, p, threads);
+
+    return 1;
+}
+
+static int v_pushchunks(lua_State* L, const Chunker* c, const std::vector<uint64_t>& cuts,
+        const std::vector<uint64_t>& fingerprints)
+{
+    FrameCrc packed = { (c->fingerprint().p.bits + 7) / 8, false, false };
+    unsigned char fp[8];
+
+    lua_createtable(L, cuts.size(), 0);
+    lua_createtable(L, cuts.size(), 0);
+    for(std::size_t i = 0; i < cuts.size(); i++) {
+        lua_pushnumber(L, cuts[i]);
+        lua_rawseti(L, -3, i + 1);
+        packed.put(fp, fingerprints[i]);
+        lua_pushlstring(L, (const char*) fp, packed.size);
+        lua_rawseti(L, -2, i + 1);
+    }
+
+    return 2;
+}
+
+/*-
+- cuts, fingerprints = chunker:feed(bytes, [start, [, end]])
+
+Append the substring of bytes (a string or buffer) from start..end, see
+crc:process(), to the stream.
+
+Returns an array of the ends of the chunks completed, as offsets in the
+stream, and an array of their fingerprints, big-endian strings of as many
+bytes as the crc has.
+*/
+static int bcrc_chunker_feed(lua_State* L)
+{
+    Chunker* c = v_checkudata<Chunker>(L, 1, L_CHUNKER_REGID);
+    size_t size;
+    const char* bytes = v_checksubstring(L, 2, &size);
+    std::vector<uint64_t> cuts;
+    std::vector<uint64_t> fingerprints;
+
+    c->feed((const unsigned char*) bytes, size, &cuts, &fingerprints);
+
+    return v_pushchunks(L, c, cuts, fingerprints);
+}
+
+/*-
+- cuts, fingerprints = chunker:finish()
+
+End the stream, cutting the last chunk, and returning it as chunker:feed()
+would. The chunker is ready for a new stream.
+*/
+static int bcrc_chunker_finish(lua_State* L)
+{
+    Chunker* c = v_checkudata<Chunker>(L, 1, L_CHUNKER_REGID);
+    std::vector<uint64_t> cuts;
+    std::vector<uint64_t> fingerprints;
+
+    c->finish(&cuts, &fingerprints);
+
+    return v_pushchunks(L, c, cuts, fingerprints);
+}
+
+static int bcrc_chunker_gc(lua_State* L)
+{
+    return v_gcudata<Chunker>(L, L_CHUNKER_REGID);
+}
+
+static const luaL_reg bcrc_chunker_methods[] =
+{
+    {"feed",         bcrc_chunker_feed},
+    {"finish",       bcrc_chunker_finish},
+    {"__gc",         bcrc_chunker_gc},
+    {NULL, NULL}
+};
+
+#define L_PCAP_WRITER_REGID "wt.bcrc.pcap_writer"
+
+/*-
+- writer = bcrc.pcap_writer(path, [options])
+
+Create a pcap file of packets, whose checksums are filled in as they are
+written, for generating captures to replay.
+
+Options is an optional table:
+
+  - linktype=n, the pcap link type, 1 for Ethernet (the default), 101 or
+    228 for raw IPv4
+  - fcs=bool, whether to append the Ethernet FCS to each frame, defaults to
+    false
+  - checksums=bool, whether to fill in the IPv4 header checksum, and the UDP
+    or TCP checksum, of IPv4 packets, defaults to true
+  - crc=bcrc, an application crc to fill in, in the UDP or TCP payload,
+    covering the rest of it, defaults to none
+  - crc_pos="tail"|"head", where the application crc is, defaults to "tail"
+  - endian="big"|"little", the byte order of the application crc, defaults
+    to "little" for crcs with reflect_remainder, otherwise "big"
+  - snaplen=n, the most bytes of a packet to write, defaults to 65535
+  - nano=bool, whether timestamps have nanosecond resolution, defaults to
+    false
+  - start=seconds, the timestamp of the first packet, defaults to now
+  - interval=seconds, between the timestamps of packets, defaults to 0.000001
+
+The checksums are filled in with Ethernet frames of IPv4 (possibly VLAN
+tagged), which aren't fragments. The fields are computed in the order
+application crc, UDP or TCP checksum, IPv4 header checksum, FCS, so each
+covers the ones before it.
+
+Returns the writer, or nil, errmsg, errno if the file can't be created.
+*/
+static int bcrc_pcap_writer(lua_State* L)
+{
+    const char* path = luaL_checkstring(L, 1);
+    v_opttable(L, 2);
+
+    lua_Integer linktype = v_optintfield(L, 2, "linktype", 1);
+    lua_Integer snaplen = v_optintfield(L, 2, "snaplen", 65535);
+    bool nano = v_optboolfield(L, 2, "nano", false);
+    bool fcs = v_optboolfield(L, 2, "fcs", false);
+    bool checksums = v_optboolfield(L, 2, "checksums", true);
+    lua_Number start = v_optnumberfield(L, 2, "start", -1);
+    lua_Number interval = v_optnumberfield(L, 2, "interval", 0.000001);
+    const Crc* app = NULL;
+    FrameCrc appframe = { 0, false, false };
+
+    luaL_argcheck(L, snaplen > 0, 2, "snaplen must be positive");
+    luaL_argcheck(L, interval >= 0, 2, "interval must not be negative");
+
+    if(lua_istable(L, 2)) {
+        lua_getfield(L, 2, "crc");
+        if(!lua_isnil(L, -1)) {
+            app = v_optcrcfield(L, 2);
+            appframe = v_optframecrc(L, 2, app);
+        }
+        lua_pop(L, 1);
+    }
+
+    if(start < 0) {
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        start = now.tv_sec + now.tv_nsec / 1e9;
+    }
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+
+    if(fd < 0)
+        return v_pusherror(L, errno);
+
+    PcapWriter** ud = v_newudata<PcapWriter>(L, L_PCAP_WRITER_REGID);
+    PcapWriter* w = new PcapWriter(fd);
+
+    *ud = w;
+    w->linktype = linktype;
+    w->snaplen = snaplen;
+    w->nano = nano;
+    w->fcs = fcs;
+    w->checksums = checksums;
+    w->app = app ? app->clone() : NULL;
+    w->appframe = appframe;
+    w->start = (uint64_t) (start * 1e9 + 0.5);
+    w->interval = (uint64_t) (interval * 1e9 + 0.5);
+
+    if(int err = w->header())
+        return v_pusherror(L, err);
+
+    return 1;
+}
+
+static PcapWriter* v_checkpcapwriter(lua_State* L)
+{
+    return v_checkudata<PcapWriter>(L, 1, L_PCAP_WRITER_REGID);
+}
+
+/* Copy the frame at narg into the writer's scratch buffer. */
+static std::vector<unsigned char>& v_checkframe(lua_State* L, int narg, std::vector<unsigned char>& scratch)
+{
+    size_t len;
+    const char* frame = v_tobuffer(L, narg, &len);
+
+    if(!frame)
+        frame = luaL_checklstring(L, narg, &len);
+    scratch.assign(frame, frame + len);
+
+    return scratch;
+}
+
+static int v_pushwritten(lua_State* L, PcapWriter* w, int nret)
+{
+    if(w->error)
+        return v_pusherror(L, w->error);
+    return nret;
+}
+
+/*-
+- writer = writer:write(frame, [fields], [time])
+
+Write a packet, a copy of frame (a string or buffer) with fields overwritten
+and its checksums filled in.
+
+Fields is an optional array of {offset, value, [size]}, each overwriting the
+bytes from the zero-based offset with value, a string, or a non-negative
+integer stored big-endian in size bytes, which it must fit in.
+
+Time is the timestamp of the packet in seconds, defaulting to the start
+time plus the interval for each packet before it.
+
+Returns the writer, or nil, errmsg, errno if a write failed.
+*/
+static int bcrc_pcap_write(lua_State* L)
+{
+    PcapWriter* w = v_checkpcapwriter(L);
+    std::vector<unsigned char>& frame = v_checkframe(L, 2, w->scratch);
+    lua_Number time = luaL_optnumber(L, 4, -1);
+
+    if(!lua_isnoneornil(L, 3)) {
+        luaL_checktype(L, 3, LUA_TTABLE);
+        for(int i = 1; ; i++) {
+            lua_rawgeti(L, 3, i);
+            if(lua_isnil(L, -1)) {
+                lua_pop(L, 1);
+                break;
+            }
+            luaL_argcheck(L, lua_istable(L, -1), 3, "each field must be {offset, value, [size]}");
+            lua_rawgeti(L, -1, 1);
+            lua_rawgeti(L, -2, 2);
+            lua_rawgeti(L, -3, 3);
+
+            lua_Number offset = luaL_checknumber(L, -3);
+            size_t size;
+            const char* bytes = lua_type(L, -2) == LUA_TSTRING ? lua_tolstring(L, -2, &size) : NULL;
+
+            if(!bytes) {
+                luaL_argcheck(L, lua_isnumber(L, -2) && lua_isnumber(L, -1), 3, "number fields need a size");
+                size = lua_tointeger(L, -1);
+                luaL_argcheck(L, size >= 1 && size <= 8, 3, "size must be 1 to 8");
+            }
+            luaL_argcheck(L, offset >= 0 && offset + size <= frame.size(), 3, "field is outside the frame");
+
+            if(bytes) {
+                memcpy(&frame[(size_t) offset], bytes, size);
+            } else {
+                FrameCrc f = { size, false, false };
+                lua_Number v = lua_tonumber(L, -2);
+                luaL_argcheck(L, v >= 0 && v == floor(v) && v < ldexp(1.0, 8 * size), 3,
+                        "field value doesn't fit in its size");
+                f.put(&frame[(size_t) offset], (uint64_t) v);
+            }
+            lua_pop(L, 4);
+        }
+    }
+
+    w->packet(frame.empty() ? NULL : &frame[0], frame.size(), time < 0 ? -1 : (int64_t) (time * 1e9 + 0.5));
+
+    lua_settop(L, 1);
+
+    return v_pushwritten(L, w, 1);
+}
+
+/*-
+- count = writer:write_many(frames)
+
+Write each of an array of frames, as writer:write() would without fields or
+time.
+
+Returns the count of frames written, or nil, errmsg, errno if a write
+failed.
+*/
+static int bcrc_pcap_write_many(lua_State* L)
+{
+    PcapWriter* w = v_checkpcapwriter(L);
+    luaL_checktype(L, 2, LUA_TTABLE);
+    int n = lua_objlen(L, 2);
+
+    for(int i = 1; i <= n; i++) {
+        lua_rawgeti(L, 2, i);
+        std::vector<unsigned char>& frame = v_checkframe(L, -1, w->scratch);
+        w->packet(frame.empty() ? NULL : &frame[0], frame.size(), -1);
+        lua_pop(L, 1);
+    }
+
+    lua_pushinteger(L, n);
+
+    return v_pushwritten(L, w, 1);
+}
+
+/*-
+- count = writer:generate(frame, count, [counters])
+
+Write count packets from a template frame, as writer:write() would, where
+the fields given by counters are incremented from one packet to the next.
+
+Counters is an optional array of {offset, size, [step]}, each a big-endian
+number of size bytes at the zero-based offset in the frame, incremented by
+step (defaulting to 1), wrapping around.
+
+Returns count, or nil, errmsg, errno if a write failed.
+*/
+static int bcrc_pcap_generate(lua_State* L)
+{
+    PcapWriter* w = v_checkpcapwriter(L);
+    lua_Number count = luaL_checknumber(L, 3);
+    std::vector<std::size_t> counters;
+
+    if(!lua_isnoneornil(L, 4)) {
+        luaL_checktype(L, 4, LUA_TTABLE);
+        for(int i = 1; ; i++) {
+            lua_rawgeti(L, 4, i);
+            if(lua_isnil(L, -1)) {
+                lua_pop(L, 1);
+                break;
+            }
+            luaL_argcheck(L, lua_istable(L, -1), 4, "each counter must be {offset, size, [step]}");
+            for(int k = 1; k <= 3; k++) {
+                lua_rawgeti(L, -1, k);
+                lua_Number v = k == 3 ? luaL_optnumber(L, -1, 1) : luaL_checknumber(L, -1);
+                luaL_argcheck(L, v >= 0, 4, "counter fields must not be negative");
+                counters.push_back((std::size_t) v);
+                lua_pop(L, 1);
+            }
+            lua_pop(L, 1);
+        }
+    }
+
+    std::vector<unsigned char> frame = v_checkframe(L, 2, w->scratch);
+
+    for(std::size_t i = 0; i < counters.size(); i += 3) {
+        luaL_argcheck(L, counters[i + 1] >= 1 && counters[i + 1] <= 8
+                && counters[i] + counters[i + 1] <= frame.size(), 4, "counter is outside the frame");
+    }
+
+    for(lua_Number i = 0; i < count; i++) {
+        w->scratch = frame;
+        w->packet(w->scratch.empty() ? NULL : &w->scratch[0], w->scratch.size(), -1);
+        for(std::size_t k = 0; k < counters.size(); k += 3) {
+            FrameCrc f = { counters[k + 1], false, false };
+            unsigned char* at = &frame[counters[k]];
+            f.put(at, f.get(at) + counters[k + 2]);
+        }
+    }
+
+    lua_pushnumber(L, count);
+
+    return v_pushwritten(L, w, 1);
+}
+
+/*-
+- writer = writer:flush()
+
+Write the buffered packets to the file.
+
+Returns the writer, or nil, errmsg, errno if a write failed.
+*/
+static int bcrc_pcap_flush(lua_State* L)
+{
+    PcapWriter* w = v_checkpcapwriter(L);
+
+    if(!w->error)
+        w->error = w->flush();
+
+    lua_settop(L, 1);
+
+    return v_pushwritten(L, w, 1);
+}
+
+/*-
+- count = writer:close()
+
+Flush and close the file.
+
+Returns the count of packets written, or nil, errmsg, errno if a write
+failed.
+*/
+static int bcrc_pcap_close(lua_State* L)
+{
+    PcapWriter** ud = (PcapWriter**) luaL_checkudata(L, 1, L_PCAP_WRITER_REGID);
+
+    if(!*ud)
+        return 0;
+
+    PcapWriter* w = *ud;
+    int err = w->close();
+    uint64_t count = w->count;
+
+    delete w;
+    *ud = NULL;
+
+    if(err)
+        return v_pusherror(L, err);
+
+    lua_pushnumber(L, count);
+
+    return 1;
+}
+
+static const luaL_reg bcrc_pcap_writer_methods[] =
+{
+    {"write",        bcrc_pcap_write},
+    {"write_many",   bcrc_pcap_write_many},
+    {"generate",     bcrc_pcap_generate},
+    {"flush",        bcrc_pcap_flush},
+    {"close",        bcrc_pcap_close},
+    {"__gc",         bcrc_pcap_close},
+    {NULL, NULL}
+};
+
+/*-
+- undetected, errored = bcrc.simulate(crc, [options])
+
+Estimate how often the crc fails to detect errors, by injecting errors into
+codewords, each a message and its crc, and counting those the crc doesn't
+detect. A crc is linear, so only the crc of the error pattern is computed,
+not of the message, and with random errors the error free bits are skipped
+over, so a trial costs only as much as its errors. The bits of a codeword
+are in the order the crc processes them.
+
+Options is an optional table:
+
+  - len=n, the bytes of a message, defaults to 64, at most 65536
+  - ber=p, inject random errors, flipping each bit with probability p
+  - burst_len=n, inject a burst error of n bits in each codeword, at a
+    random position, its first and last bits flipped, and those between at
+    random
+  - trials=n, the count of codewords, defaults to 1000000
+  - threads=n, defaults to the number of online CPUs
+  - seed=n, of the random numbers, defaults to 1
+
+Either ber or burst_len must be given.
+
+Returns the count of codewords with errors that weren't detected, and the
+count with errors.
+*/
+static int bcrc_simulate(lua_State* L)
+{
+    Crc* crc = checkudata(L, 1);
+    v_opttable(L, 2);
+
+    lua_Integer len = v_optintfield(L, 2, "len", 64);
+    lua_Number ber = v_optnumberfield(L, 2, "ber", -1);
+    lua_Number burst = v_optnumberfield(L, 2, "burst_len", -1);
+    lua_Number trials = v_optnumberfield(L, 2, "trials", 1000000);
+    lua_Integer threads = v_optintfield(L, 2, "threads", online_cpus());
+    lua_Number seed = v_optnumberfield(L, 2, "seed", 1);
+    std::size_t bits = crc->params().bits;
+
+    luaL_argcheck(L, len >= 1 && len <= 65536, 2, "len must be 1 to 65536");
+    luaL_argcheck(L, (ber >= 0) != (burst >= 0), 2, "one of ber or burst_len is required");
+    luaL_argcheck(L, ber <= 1, 2, "ber must be at most 1");
+    luaL_argcheck(L, burst < 0 || (burst >= 1 && burst <= len * 8 + (lua_Number) bits), 2,
+            "burst_len must be 1 to the bits of a codeword");
+    luaL_argcheck(L, trials >= 0, 2, "trials must not be negative");
+    luaL_argcheck(L, threads > 0, 2, "threads must be positive");
+
+    Simulation sim(crc->gf2(), len);
+
+    sim.trials = (uint64_t) trials;
+    sim.ber = ber;
+    sim.burst = burst > 0 ? (uint64_t) burst : 0;
+    sim.seed = (uint64_t) seed;
+
+    parallel_for((sim.trials + Simulation::BLOCK - 1) / Simulation::BLOCK, threads, Simulation::run, &sim);
+
+    lua_pushnumber(L, sim.undetected);
+    lua_pushnumber(L, sim.errored);
+
+    return 2;
+}
+
+#define L_JOURNAL_REGID "wt.bcrc.journal"
+
+/*-
+- journal = bcrc.journal(path, [params])
+
+Open an append-only journal of records, creating the file if it doesn't
+exist. Each record is stored as its u32le length, the record, and the crc of
+both, so the file can also be read by bcrc.records() with cover_length=true.
+
+Params is an optional table:
+
+  - crc=crc, the crc object to use, defaults to bcrc.crc32()
+  - endian="big"|"little", byte order of the crc, defaults to "little" if the
+    crc has reflect_remainder, otherwise "big"
+  - group=n, bytes of appended records to buffer before they are written and
+    synced together, defaults to 65536, so 0 commits every append
+  - sync=bool, whether a commit syncs the file to storage, defaults to true
+  - threads=n, to recover with, defaults to the number of online CPUs
+
+Returns nil, errmsg, errno if the file can't be opened.
+*/
+static int bcrc_journal(lua_State* L)
+{
+    const char* path = luaL_checkstring(L, 1);
+    v_opttable(L, 2);
+
+    const Crc* crc = v_optcrcfield(L, 2);
+    FrameCrc frame = v_optframecrc(L, 2, crc);
+    lua_Integer group = v_optintfield(L, 2, "group", 65536);
+    bool sync = v_optboolfield(L, 2, "sync", true);
+    lua_Integer threads = v_optintfield(L, 2, "threads", online_cpus());
+
+    luaL_argcheck(L, group >= 0, 2, "group must not be negative");
+    luaL_argcheck(L, threads > 0, 2, "threads must be positive");
+
+    int fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0666);
+    struct stat st;
+
+    if(fd < 0)
+        return v_pusherror(L, errno);
+
+    if(fstat(fd, &st) < 0) {
+        int err = errno;
+        close(fd);
+        return v_pusherror(L, err);
+    }
+
+    Journal** ud = v_newudata<Journal>(L, L_JOURNAL_REGID);
+    Journal* j = new Journal(fd, path, crc);
+
+    *ud = j;
+    j->format.frame = frame;
+    j->group = group;
+    j->sync = sync;
+    j->threads = threads;
+    j->size = st.st_size;
+
+    return 1;
+}
+
+static Journal* v_checkjournal(lua_State* L)
+{
+    return v_checkudata<Journal>(L, 1, L_JOURNAL_REGID);
+}
+
+/*-
+- journal = journal:append(record)
+
+Append a record, a string. Records are buffered until group bytes of them
+are appended, then written and synced together, so a crash can lose the
+records appended since the last commit, but not those before it.
+
+Returns the journal, or nil, errmsg, errno if a commit failed.
+*/
+static int bcrc_journal_append(lua_State* L)
+{
+    Journal* j = v_checkjournal(L);
+    size_t size;
+    const char* record = luaL_checklstring(L, 2, &size);
+
+    luaL_argcheck(L, size <= 0xFFFFFFFF, 2, "record is longer than 4G");
+
+    if(int err = j->append(record, size))
+        return v_pusherror(L, err);
+
+    lua_settop(L, 1);
+
+    return 1;
+}
+
+/*-
+- journal = journal:commit()
+
+Write and sync the buffered records.
+
+Returns the journal, or nil, errmsg, errno if the commit failed.
+*/
+static int bcrc_journal_commit(lua_State* L)
+{
+    Journal* j = v_checkjournal(L);
+
+    if(int err = j->commit())
+        return v_pusherror(L, err);
+
+    lua_settop(L, 1);
+
+    return 1;
+}
+
+/*-
+- records, tail = journal:recover()
+
+Read the journal after a crash, verifying the crc of every record. The file
+is mapped into memory, the record boundaries found by following the lengths,
+and the records verified in parallel. The journal ends at the first record
+that is incomplete or doesn't verify, and the file is truncated there, so
+appends follow the last good record.
+
+Returns an array of the records, and the size of the journal, or nil, errmsg,
+errno if the file can't be read or truncated.
+*/
+static int bcrc_journal_recover(lua_State* L)
+{
+    Journal* j = v_checkjournal(L);
+    std::vector<uint64_t> starts;
+    Mapping m;
+
+    if(int err = j->recover(&m, &starts))
+        return v_pusherror(L, err);
+
+    std::size_t n = starts.size() - 1;
+    std::size_t lenbytes = j->format.lenbytes;
+    std::size_t crcbytes = j->format.crcbytes();
+
+    lua_createtable(L, n, 0);
+    for(std::size_t i = 0; i < n; i++) {
+        lua_pushlstring(L, (const char*) m.data + starts[i] + lenbytes, starts[i + 1] - starts[i] - lenbytes - crcbytes);
+        lua_rawseti(L, -2, i + 1);
+    }
+    lua_pushnumber(L, starts.back());
+
+    return 2;
+}
+
+/*-
+- journal:close()
+
+Commit the buffered records, and close the file.
+
+Returns true, or nil, errmsg, errno if the commit failed.
+*/
+static int bcrc_journal_close(lua_State* L)
+{
+    Journal** ud = (Journal**) luaL_checkudata(L, 1, L_JOURNAL_REGID);
+
+    if(!*ud)
+        return 0;
+
+    int err = (*ud)->close();
+
+    delete *ud;
+    *ud = NULL;
+
+    if(err)
+        return v_pusherror(L, err);
+
+    lua_pushboolean(L, true);
+
+    return 1;
+}
+
+static const luaL_reg bcrc_journal_methods[] =
+{
+    {"append",       bcrc_journal_append},
+    {"commit",       bcrc_journal_commit},
+    {"recover",      bcrc_journal_recover},
+    {"close",        bcrc_journal_close},
+    {"__gc",         bcrc_journal_close},
+    {NULL, NULL}
+};
+
+#define L_E2E_REGID "wt.bcrc.e2e"
 
-        CrcBasic(
-                 int truncated_polynominal,
-                 int initial_remainder,
-                 int final_xor_value,
-                 bool reflect_input,
-                 bool reflect_remainder
-            ) : crc_(
-                 truncated_polynominal,
-                 initial_remainder,
-                 final_xor_value,
-                 reflect_input,
-                 reflect_remainder
-            )
-        {
-        }
+/*-
+- profile = bcrc.e2e.profile(name, [options])
 
-        ~CrcBasic() {};
+Create an AUTOSAR E2E protection of the messages of a signal, by profile name,
+"P01", "P02", "P04", "P05" or "P07". The same object protects the messages
+a sender sends, and checks those a receiver receives. Messages include the
+space for the header, which is:
 
-        void reset()
-        {
-            crc_.reset();
-        }
+  - P01, a CRC-8/SAE-J1850 byte, and a 4 bit counter, 0 to 14
+  - P02, a CRC-8H2F byte, then a byte whose low nibble is a counter, 0 to 15
+  - P04, a 12 byte header, big-endian: a 16 bit length, a 16 bit counter, a
+    32 bit data ID, and a CRC-32P4
+  - P05, a 3 byte header: a little-endian CRC-16/CCITT-FALSE, then an 8 bit
+    counter
+  - P07, a 20 byte header, big-endian: a CRC-64/XZ, a 32 bit length, a 32
+    bit counter, and a 32 bit data ID
 
-        void process_bytes(const void* buffer, size_t byte_count)
-        {
-            crc_.process_bytes(buffer, byte_count);
-        }
+The crc covers the whole message but itself, and the data ID, where the data
+ID isn't in the header.
 
-        uintmax_t checksum() const
-        {
-            return crc_.checksum();
-        }
-};
+Options is an optional table:
 
-template < class Optimal >
-class CrcOptimal : public Crc
+  - data_id=n, the data ID, of 16 bits for P01 and P05, 32 bits for P04 and
+    P07, defaults to 0
+  - data_id_list={...}, for P02, the 16 data ID bytes, one for each counter
+    value
+  - data_id_mode="both"|"alt"|"low"|"nibble", for P01, how the data ID is
+    covered: both bytes, the low byte for even counters and the high for odd,
+    the low byte only, or the low byte, with the low nibble of the high byte
+    in the message, defaults to "both"
+  - offset=n, the byte offset of the header, or for P01 of the crc, defaults
+    to 0
+  - counter_offset=n, for P01, the bit offset of the counter, defaults to 8
+  - data_id_nibble_offset=n, for P01, the bit offset of the data ID nibble,
+    defaults to 12
+  - max_delta_counter=n, the most the counter may advance between messages
+    received, defaults to 1
+*/
+static int bcrc_e2e_profile(lua_State* L)
 {
-    private:
+    static const char* const profiles[] = { "P01", "P02", "P04", "P05", "P07", NULL };
+    static const char* const modes[] = { "both", "alt", "low", "nibble", NULL };
 
-        Optimal crc_;
+    int profile = luaL_checkoption(L, 1, NULL, profiles);
+    v_opttable(L, 2);
 
-    public:
+    lua_Number data_id = v_optnumberfield(L, 2, "data_id", 0);
+    int mode = v_optoptionfield(L, 2, "data_id_mode", E2eProfile::BOTH, modes);
+    lua_Integer offset = v_optintfield(L, 2, "offset", 0);
+    lua_Integer counter_offset = v_optintfield(L, 2, "counter_offset", 8);
+    lua_Integer nibble_offset = v_optintfield(L, 2, "data_id_nibble_offset", 12);
+    lua_Number max_delta = v_optnumberfield(L, 2, "max_delta_counter", 1);
 
-        ~CrcOptimal() {};
+    luaL_argcheck(L, data_id >= 0 && data_id <= (profile == E2eProfile::P04 || profile == E2eProfile::P07
+                ? 0xFFFFFFFF : 0xFFFF), 2, "data_id out of range");
+    luaL_argcheck(L, offset >= 0, 2, "offset must not be negative");
+    luaL_argcheck(L, counter_offset >= 0 && counter_offset % 4 == 0 && nibble_offset >= 0 && nibble_offset % 4 == 0,
+            2, "counter_offset and data_id_nibble_offset must be multiples of 4");
+    luaL_argcheck(L, max_delta >= 1, 2, "max_delta_counter must be positive");
+    luaL_argcheck(L, profile != E2eProfile::P01 || counter_offset / 8 != offset, 2, "counter_offset overlaps the crc");
+    luaL_argcheck(L, profile != E2eProfile::P02 || lua_istable(L, 2), 2, "P02 requires a data_id_list");
 
-        void reset()
-        {
-            crc_.reset();
-        }
+    E2eProfile** ud = v_newudata<E2eProfile>(L, L_E2E_REGID);
+    E2eProfile* e = new E2eProfile((E2eProfile::Profile) profile);
 
-        void process_bytes(const void* buffer, size_t byte_count)
-        {
-            crc_.process_bytes(buffer, byte_count);
-        }
+    *ud = e;
+    e->data_id = (uint32_t) data_id;
+    e->data_id_mode = mode;
+    e->offset = offset;
+    e->counter_offset = counter_offset;
+    e->nibble_offset = nibble_offset;
+    e->max_delta = max_delta < e->countermax() ? (uint32_t) max_delta : e->countermax() - 1;
 
-        uintmax_t checksum() const
-        {
-            return crc_.checksum();
+    if(profile == E2eProfile::P02) {
+        lua_getfield(L, 2, "data_id_list");
+        luaL_argcheck(L, lua_istable(L, -1) && lua_objlen(L, -1) == 16, 2, "P02 requires a data_id_list of 16");
+        for(int i = 0; i < 16; i++) {
+            lua_rawgeti(L, -1, i + 1);
+            e->data_ids[i] = (unsigned char) luaL_checkinteger(L, -1);
+            lua_pop(L, 1);
         }
-};
+        lua_pop(L, 1);
+    }
 
-extern "C" {
-#include "lua.h"
-#include "lauxlib.h"
-#include "lualib.h"
+    return 1;
 }
 
-#undef LUALIB_API
-#define LUALIB_API extern "C"
-
-static void v_obj_metatable(lua_State* L, const char* regid, const struct luaL_reg methods[])
+static E2eProfile* v_checke2e(lua_State* L)
 {
-    /* metatable = { ... methods ... } */
-    luaL_newmetatable(L, regid);
-    luaL_register(L, NULL, methods);
-    /* metatable["__index"] = metatable */
-    lua_pushvalue(L, -1);
-    lua_setfield(L, -2, "__index");
-    lua_pop(L, 1);
+    return v_checkudata<E2eProfile>(L, 1, L_E2E_REGID);
 }
 
-static ptrdiff_t posrelat(ptrdiff_t pos, size_t len)
-{
-    /* relative string position: negative means back from end */
-    if (pos < 0) pos += (ptrdiff_t)len + 1;
-    return (pos >= 0) ? pos : 0;
-}
+/*-
+- protected = profile:protect(bytes)
 
-static const char* v_checksubstring(lua_State *L, int narg, size_t* lp)
+Fill in the header of a message, with the next counter. Bytes is a string,
+and a copy of it is returned, protected, or a bcrc.buffer(), which is
+protected in place, and returned.
+*/
+static int bcrc_e2e_protect(lua_State* L)
 {
-    size_t l;
-    const char *s = luaL_checklstring(L, narg, &l);
-    ptrdiff_t start = posrelat(luaL_optinteger(L, narg+1, 1), l);
-    ptrdiff_t end = posrelat(luaL_optinteger(L, narg+2, -1), l);
-    if (start < 1) start = 1;
-    if (end > (ptrdiff_t)l) end = (ptrdiff_t)l;
-    if (start <= end) {
-        *lp = end-start+1;
-        return s+start-1;
-    } else {
-        *lp = 0;
-        return "";
+    E2eProfile* e = v_checke2e(L);
+    size_t size;
+    char* buffer = v_tobuffer(L, 2, &size);
+    const char* bytes = buffer ? buffer : luaL_checklstring(L, 2, &size);
+
+    if(size < e->header())
+        return luaL_argerror(L, 2, "message is shorter than its header");
+
+    if(buffer) {
+        e->protect((unsigned char*) buffer, size);
+        lua_settop(L, 2);
+        return 1;
     }
+
+    std::string copy(bytes, size);
+
+    e->protect((unsigned char*) &copy[0], size);
+    lua_pushlstring(L, copy.data(), size);
+
+    return 1;
 }
 
-#define L_CRC_REGID "wt.bcrc"
+/*-
+- status, counter = profile:check(bytes)
+
+Check a received message, a string or buffer. Returns its status, and its
+counter, which is nil unless the status is one of:
 
-static Crc* checkudata(lua_State* L)
+  - "OK", the message is valid, and is the first, or its counter advanced by
+    at most max_delta_counter
+  - "REPEATED", the message is valid, but its counter didn't advance
+  - "WRONGSEQUENCE", the message is valid, but its counter advanced too far,
+    so messages were lost
+
+Otherwise the status is "ERROR": the crc, data ID or length is wrong, or the
+message is shorter than its header.
+*/
+static int bcrc_e2e_check(lua_State* L)
 {
-    Crc** ud = (Crc**) luaL_checkudata(L, 1, L_CRC_REGID);
+    static const char* const statuses[] = { "OK", "REPEATED", "WRONGSEQUENCE", "ERROR" };
 
-    luaL_argcheck(L, *ud, 1, "bcrc state has been destroyed");
+    E2eProfile* e = v_checke2e(L);
+    size_t size;
+    const char* bytes = v_checksubstring(L, 2, &size);
+    uint32_t counter = 0;
+    E2eProfile::Status status = e->check((const unsigned char*) bytes, size, &counter);
 
-    return *ud;
+    lua_pushstring(L, statuses[status]);
+
+    if(status == E2eProfile::ERROR)
+        return 1;
+
+    lua_pushnumber(L, counter);
+
+    return 2;
 }
 
-static Crc** newudata(lua_State* L)
+static int bcrc_e2e_gc(lua_State* L)
 {
-    Crc** ud = (Crc**) lua_newuserdata(L, sizeof(*ud));
-    *ud = NULL;
+    return v_gcudata<E2eProfile>(L, L_E2E_REGID);
+}
 
-    luaL_getmetatable(L, L_CRC_REGID);
-    lua_setmetatable(L, -2);
+static const luaL_reg bcrc_e2e_methods[] =
+{
+    {"protect",      bcrc_e2e_protect},
+    {"check",        bcrc_e2e_check},
+    {"__gc",         bcrc_e2e_gc},
+    {NULL, NULL}
+};
 
-    return ud;
-}
+static const luaL_reg bcrc_e2e[] =
+{
+    {"profile",      bcrc_e2e_profile},
+    {NULL, NULL}
+};
 
 /*-
-- crc = bcrc.new(bits, poly[, initial, xor, reflect_input, reflect_remainder])
+- pids, packets, resyncs, errors = bcrc.mpegts(path_or_bytes, [options])
 
-Mandatory args:
+Walk the packets of an MPEG transport stream, reassembling the PSI/SI
+sections of each PID across packets, and validating the CRC-32/MPEG-2 of each
+section that has one. Sections are reassembled on the PAT, CAT and DVB SI
+PIDs (0x00, 0x01, and 0x10 to 0x14), the PMT and NIT PIDs of the programs in
+the PAT, and those in options.pids.
 
-  - bits=n, where n is 8, 16, 24, 32
-  - poly=n, where n is the polynomial
+Path_or_bytes is the path of a file, which is mapped into memory, or if
+options has data=true, the bytes of the stream.
 
-Optional args:
+Options is an optional table:
 
-  - initial=n, where n is the initial value for the crc, defaults to 0
-  - xor=n, where n is the value to xor with the final value, defaults to 0
-  - reflect_input=bool, defaults to false
-  - reflect_remainder=bool, defaults to false
+  - pids={...}, more PIDs carrying sections
+  - packet_size=188|192|204, bytes of a packet, 192 for M2TS with a 4 byte
+    timestamp before each packet, 204 with 16 bytes of Reed-Solomon parity
+    after it, defaults to 188
+  - data=bool, whether path_or_bytes is the bytes, defaults to false
 
-Returns a crc object.
+Returns a table indexed by PID, of a table for each PID with packets:
+
+  - packets, the count of its packets
+  - cc_errors, the count of its continuity counter errors, and of sections
+    lost to them
+  - sections, crc_errors, the count of its sections, and of those whose crc
+    didn't verify, for PIDs of sections
+  - tables, a table of the count of its sections of each table_id, for PIDs
+    of sections
+
+Also returns the count of packets, of times sync was lost, and of packets
+with the transport error indicator set. Returns nil, errmsg, errno if the
+file can't be mapped.
 */
-static int bcrc_new(lua_State *L)
+static int bcrc_mpegts(lua_State* L)
 {
-    int bits = luaL_checkint(L, 1);
-    int poly = luaL_checkint(L, 2);
-    int initial = luaL_optint(L, 3, 0);
-    int xor_ = luaL_optint(L, 4, 0);
-    int reflect_input = lua_toboolean(L, 5);
-    int reflect_remainder = lua_toboolean(L, 6);
+    luaL_checkstring(L, 1);
+    v_opttable(L, 2);
 
-    Crc** ud = newudata(L);
+    lua_Integer packet_size = v_optintfield(L, 2, "packet_size", 188);
 
-    switch(bits) {
-        case  8: *ud = new CrcBasic< 8>(poly, initial, xor_, reflect_input, reflect_remainder); break;
-        case 16: *ud = new CrcBasic<16>(poly, initial, xor_, reflect_input, reflect_remainder); break;
-        case 24: *ud = new CrcBasic<24>(poly, initial, xor_, reflect_input, reflect_remainder); break;
-        case 32: *ud = new CrcBasic<32>(poly, initial, xor_, reflect_input, reflect_remainder); break;
-        default: return luaL_argerror(L, 2, "unsupported crc bit width");
+    luaL_argcheck(L, packet_size == 188 || packet_size == 192 || packet_size == 204, 2,
+            "packet_size must be 188, 192 or 204");
+
+    TsDemux ts(packet_size);
+
+    if(lua_istable(L, 2)) {
+        lua_getfield(L, 2, "pids");
+        if(lua_istable(L, -1)) {
+            for(int i = 1; i <= (int) lua_objlen(L, -1); i++) {
+                lua_rawgeti(L, -1, i);
+                ts.sections(luaL_checkinteger(L, -1));
+                lua_pop(L, 1);
+            }
+        }
+        lua_pop(L, 1);
     }
 
-    luaL_argcheck(L, *ud, 1, "out of memory");
+    Mapping m;
+    int err = v_checkinput(L, 1, 2, &m);
 
-    return 1;
-}
+    if(err)
+        return v_pusherror(L, err);
 
-/*-
-- crc = bcrc.crc16()
+    ts.walk(m.data, m.size);
 
-An optimal implementation of bcrc.new(16, 0x8005, 0, 0, true, true).
-*/
+    lua_newtable(L);
+    for(std::size_t pid = 0; pid < TsDemux::NPIDS; pid++) {
+        const TsDemux::Pid& s = ts.pids[pid];
 
-/*-
-- crc = bcrc.ccitt()
+        if(!s.packets)
+            continue;
 
-An optimal implementation of bcrc.new(16, 0x1021, 0xFFFF, 0, false, false).
-*/
+        lua_newtable(L);
+        lua_pushnumber(L, s.packets);
+        lua_setfield(L, -2, "packets");
+        lua_pushnumber(L, s.cc_errors);
+        lua_setfield(L, -2, "cc_errors");
+        if(!s.tables.empty()) {
+            lua_pushnumber(L, s.sections);
+            lua_setfield(L, -2, "sections");
+            lua_pushnumber(L, s.crc_errors);
+            lua_setfield(L, -2, "crc_errors");
+            lua_newtable(L);
+            for(int t = 0; t < 256; t++) {
+                if(s.tables[t]) {
+                    lua_pushnumber(L, s.tables[t]);
+                    lua_rawseti(L, -2, t);
+                }
+            }
+            lua_setfield(L, -2, "tables");
+        }
+        lua_rawseti(L, -2, pid);
+    }
+    lua_pushnumber(L, ts.packets);
+    lua_pushnumber(L, ts.resyncs);
+    lua_pushnumber(L, ts.errors);
 
-/*-
-- crc = bcrc.xmodem()
+    return 4;
+}
 
-An optimal implementation of bcrc.new(16, 0x8408, 0, 0, true, true).
-*/
+#define L_ASSEMBLER_REGID "wt.bcrc.assembler"
 
 /*-
-- crc = bcrc.crc32()
-
-An optimal implementation of bcrc.new(32, 0x04C11DB7, 0xFFFFFFFF, 0xFFFFFFFF, true, true).
-*/
+- assembler = bcrc.assembler(crc, total_len)
 
-/*
-Above methods are all instantiated from a single template function.
+Create an assembler of the crc of an object of total_len bytes from its
+segments, added in any order, for example as the ranges of a parallel
+download arrive. Only the crcs of the segments are kept, and combined with
+polynomial arithmetic, see crc:shift(), never their bytes.
 */
-template < class Optimal >
-static int bcrc_optimal(lua_State* L)
+static int bcrc_assembler(lua_State* L)
 {
-    Crc** ud = newudata(L);
-    *ud = new CrcOptimal<Optimal>();
-    luaL_argcheck(L, *ud, 1, "out of memory");
-    return 1;
-}
+    Crc* crc = checkudata(L, 1);
+    lua_Number total = luaL_checknumber(L, 2);
 
-/*-
-- self = crc:reset()
+    luaL_argcheck(L, total >= 0, 2, "total_len must not be negative");
 
-Resets the crc to it's initial state.
+    Assembler** ud = v_newudata<Assembler>(L, L_ASSEMBLER_REGID);
+
+    *ud = new Assembler(crc, (uint64_t) total);
 
-Returns the crc object.
-*/
-static int bcrc_reset (lua_State *L)
-{
-    Crc* ud = checkudata(L);
-    ud->reset();
     return 1;
 }
 
-/*-
-- self = crc:process(bytes, [start, [, end]])
-
-Process substring of bytes from start..end.
-
-If end is absent, it defaults to -1, the end of the bytes.
-If start is absent, it defaults to 1, the start of the bytes.
+static Assembler* v_checkassembler(lua_State* L)
+{
+    return v_checkudata<Assembler>(L, 1, L_ASSEMBLER_REGID);
+}
 
-Returns the crc object.
+/*
+A checksum of a crc of bits, a number, or a big-endian string of as many
+bytes as the crc has, which is exact for crcs wider than 53 bits.
 */
-static int bcrc_process(lua_State *L)
+static uintmax_t v_checkchecksum(lua_State* L, int narg, std::size_t bits)
 {
-    Crc* ud = checkudata(L);
-    size_t size = 0;
-    const void* bytes = v_checksubstring(L, 2, &size);
+    if(lua_type(L, narg) == LUA_TSTRING) {
+        size_t len;
+        const char* s = lua_tolstring(L, narg, &len);
+        uintmax_t v = 0;
 
-    ud->process_bytes(bytes, size);
+        luaL_argcheck(L, len == (bits + 7) / 8, narg, "checksum string must be as long as the crc");
 
-    lua_settop(L, 1);
+        for(size_t i = 0; i < len; i++) {
+            v = v << 8 | (unsigned char) s[i];
+        }
+        luaL_argcheck(L, bits >= 64 || v >> bits == 0, narg, "checksum out of range");
 
-    return 1;
+        return v;
+    }
+
+    lua_Number v = luaL_checknumber(L, narg);
+
+    luaL_argcheck(L, v >= 0 && v == floor(v) && v < ldexp(1.0, bits), narg, "checksum out of range");
+
+    return (uintmax_t) v;
 }
 
-#if 0
-    /*-
-    - self = crc:process_bit(bool)
+/*-
+- assembler = assembler:add(offset, bytes)
+- assembler = assembler:add(offset, checksum, len)
 
-    Process a single bit, a boolean.
+Add the segment of the object at zero-based offset, either its bytes, a
+string or buffer, or its len and its checksum by the crc, as crc(bytes)
+returns it, or as a big-endian string of as many bytes as the crc has, which
+is exact for crcs wider than 53 bits.
 
-    Returns the crc object.
+Bytes already covered by segments added are skipped, but a segment given by
+its checksum mustn't overlap them, unless it lies within bytes already
+covered, in which case it is ignored.
+*/
+static int bcrc_assembler_add(lua_State* L)
+{
+    Assembler* a = v_checkassembler(L);
+    lua_Number offset = luaL_checknumber(L, 2);
 
-    TODO - if necessary (but it can't be supported by optimal implementations)
-    */
-    static int bcrc_process_bit(lua_State *L)
-    {
-        Crc* ud = checkudata(L);
+    luaL_argcheck(L, offset >= 0, 2, "offset must not be negative");
 
-        luaL_checktype(L, 2, LUA_TBOOLEAN);
+    if(lua_isnoneornil(L, 4)) {
+        size_t size;
+        const char* bytes = v_tobuffer(L, 3, &size);
 
-        ud->process_bit(lua_toboolean(L, 2));
+        if(!bytes)
+            bytes = luaL_checklstring(L, 3, &size);
 
-        lua_settop(L, 1);
+        luaL_argcheck(L, offset + size <= a->total, 3, "segment ends beyond total_len");
 
-        return 1;
+        a->add_bytes((uint64_t) offset, (const unsigned char*) bytes, size);
+    } else {
+        uintmax_t checksum = v_checkchecksum(L, 3, a->bits());
+        lua_Number len = luaL_checknumber(L, 4);
+
+        luaL_argcheck(L, len >= 0 && offset + len <= a->total, 4, "segment ends beyond total_len");
+
+        if(a->overlaps((uint64_t) offset, (uint64_t) len)) {
+            std::map<uint64_t, uint64_t>::const_iterator r = a->overlap((uint64_t) offset, (uint64_t) (offset + len));
+            if(r->first > offset || r->second < offset + len)
+                return luaL_argerror(L, 2, "segment overlaps those added");
+        } else {
+            a->add_checksum((uint64_t) offset, checksum, (uint64_t) len);
+        }
     }
-#endif
 
-/*-
-- checksum = crc:checksum()
+    lua_settop(L, 1);
 
-Returns the current crc checksum (it is possible to keep calling process()
-after this).
-*/
-static int bcrc_checksum (lua_State *L)
-{
-    Crc* ud = checkudata(L);
-    lua_pushinteger(L, ud->checksum());
     return 1;
 }
 
 /*-
-- checksum = crc(bytes, ...)
+- checksum = assembler:checksum()
 
-Checksum in a single call, so
+Returns the checksum of the object, or nil and the count of bytes not yet
+covered, if the segments added don't cover it.
+*/
+static int bcrc_assembler_checksum(lua_State* L)
+{
+    Assembler* a = v_checkassembler(L);
 
-  checksum = crc(bytes, start, end)
+    if(a->covered < a->total) {
+        lua_pushnil(L);
+        lua_pushnumber(L, a->total - a->covered);
+        return 2;
+    }
 
-is a short form for
+    lua_pushnumber(L, a->checksum());
 
-  checksum = crc:reset():process(bytes, start, end):checksum()
+    return 1;
+}
 
-See crc:process() for a description of bytes, start, end, and their default values.
-*/
-static int bcrc_call (lua_State *L)
+static int bcrc_assembler_gc(lua_State* L)
 {
-    bcrc_reset(L);
-    bcrc_process(L);
-    return bcrc_checksum(L);
+    return v_gcudata<Assembler>(L, L_ASSEMBLER_REGID);
 }
 
-static int bcrc_gc (lua_State *L)
+static const luaL_reg bcrc_assembler_methods[] =
 {
-    Crc** ud = (Crc**) luaL_checkudata(L, 1, L_CRC_REGID);
-    delete *ud;
-    *ud = NULL;
-    return 0;
-}
+    {"add",          bcrc_assembler_add},
+    {"checksum",     bcrc_assembler_checksum},
+    {"__gc",         bcrc_assembler_gc},
+    {NULL, NULL}
+};
 
 static const luaL_reg bcrc_methods[] =
 {
     {"reset",        bcrc_reset},
     {"process",      bcrc_process},
     {"checksum",     bcrc_checksum},
+    {"xpow",         bcrc_xpow},
+    {"mulmod",       bcrc_mulmod},
+    {"shift",        bcrc_shift},
+    {"reflect",      bcrc_reflect},
+    {"copy",         bcrc_copy},
+    {"verify_many",  bcrc_verify_many},
+    {"shadow",       bcrc_shadow},
+    {"shadow_stats", bcrc_shadow_stats},
     {"__call",       bcrc_call},
     {"__gc",         bcrc_gc},
     {NULL, NULL}
@@ -396,19 +8010,65 @@ static const luaL_reg bcrc_methods[] =
 static const luaL_reg bcrc[] =
 {
     {"new",          bcrc_new},
+    {"shared_unlink", bcrc_shared_unlink},
     {"crc16",        bcrc_optimal<boost::crc_16_type>},
     {"ccitt",        bcrc_optimal<boost::crc_ccitt_type>},
     {"xmodem",       bcrc_optimal<boost::crc_xmodem_type>},
     {"crc32",        bcrc_optimal<boost::crc_32_type>},
+    {"t10dif",       bcrc_optimal<T10Dif::crc_type>},
+    {"mpeg2",        bcrc_optimal<Mpeg2Crc::crc_type>},
+    {"udp_validator", bcrc_udp_validator},
+    {"records",      bcrc_records},
+    {"shard",        bcrc_shard},
+    {"ring_producer", bcrc_ring_producer},
+    {"ring_consumer", bcrc_ring_consumer},
+    {"ring_unlink",  bcrc_ring_unlink},
+    {"buffer",       bcrc_buffer},
+    {"t10pi",        bcrc_t10pi},
+    {"delta",        bcrc_delta},
+    {"prbs",         bcrc_prbs},
+    {"relay",        bcrc_relay},
+    {"chunker",      bcrc_chunker},
+    {"pcap_writer",  bcrc_pcap_writer},
+    {"simulate",     bcrc_simulate},
+    {"array",        bcrc_array},
+    {"journal",      bcrc_journal},
+    {"mpegts",       bcrc_mpegts},
+    {"assembler",    bcrc_assembler},
     {NULL, NULL}
 };
 
 LUALIB_API int luaopen_bcrc (lua_State *L)
 {
     v_obj_metatable(L, L_CRC_REGID, bcrc_methods);
+    v_obj_metatable(L, L_UDP_REGID, bcrc_udp_methods);
+    v_obj_metatable(L, L_RING_PRODUCER_REGID, bcrc_ring_producer_methods);
+    v_obj_metatable(L, L_RING_CONSUMER_REGID, bcrc_ring_consumer_methods);
+    v_obj_metatable(L, L_BUFFER_REGID, bcrc_buffer_methods);
+    v_obj_metatable(L, L_PRBS_REGID, bcrc_prbs_methods);
+    v_obj_metatable(L, L_CHUNKER_REGID, bcrc_chunker_methods);
+    v_obj_metatable(L, L_PCAP_WRITER_REGID, bcrc_pcap_writer_methods);
+    v_obj_metatable(L, L_ARRAY_REGID, bcrc_array_methods);
+    v_obj_metatable(L, L_JOURNAL_REGID, bcrc_journal_methods);
+    v_obj_metatable(L, L_E2E_REGID, bcrc_e2e_methods);
+    v_obj_metatable(L, L_ASSEMBLER_REGID, bcrc_assembler_methods);
+
+    /* arrays are indexed by number as well as by method name */
+    luaL_getmetatable(L, L_ARRAY_REGID);
+    lua_pushcfunction(L, bcrc_array_index);
+    lua_setfield(L, -2, "__index");
+    lua_pop(L, 1);
 
     luaL_register(L, "bcrc", bcrc);
 
+    lua_newtable(L);
+    luaL_register(L, NULL, bcrc_firmware);
+    lua_setfield(L, -2, "firmware");
+
+    lua_newtable(L);
+    luaL_register(L, NULL, bcrc_e2e);
+    lua_setfield(L, -2, "e2e");
+
     return 1;
 }
 
@@ -118,3 +118,1342 @@ function test_dnp3()
         0x01), 0x81da)
 end
 
+
+function test_udp_validator()
+    local rx = assert(bcrc.udp_validator("127.0.0.1:0", {crc=bcrc.crc32()}))
+    local tx = assert(bcrc.udp_validator("127.0.0.1:0"))
+    local addr = rx:address()
+
+    assert(addr:match("^127%.0%.0%.1:%d+$"))
+    assert_equal(3, tx:send(addr, {"hello", "", "world"}))
+    assert_equal(2, tx:send(addr, {"bad", "crc!!"}, true))
+
+    local got, invalid = {}, 0
+    while #got + invalid < 5 do
+        local payloads, bad = assert(rx:recv(1000))
+        assert(#payloads + bad > 0, "timed out")
+        for _, p in ipairs(payloads) do
+            table.insert(got, p)
+        end
+        invalid = invalid + bad
+    end
+    assert_equal("hello", got[1])
+    assert_equal("", got[2])
+    assert_equal("world", got[3])
+    assert_equal(2, invalid)
+
+    local payloads, bad = rx:recv(0)
+    assert_equal(0, #payloads)
+    assert_equal(0, bad)
+
+    local stats = rx:stats()
+    assert_equal(5, stats.received)
+    assert_equal(3, stats.valid)
+    assert_equal(2, stats.invalid)
+
+    -- crc-16 at the head, counting only
+    local crc = bcrc.new(16, 0x3D65, 0, 0xffff, true, true)
+    local rx16 = assert(bcrc.udp_validator("127.0.0.1:0", {crc=crc, crc_pos="head", payloads=false}))
+    local tx16 = assert(bcrc.udp_validator("127.0.0.1:0", {crc=crc, crc_pos="head"}))
+    assert_equal(1, tx16:send(rx16:address(), {"123456789"}))
+    assert_equal(1, tx16:send(rx16:address(), {string.char(0x82, 0xEA).."123456789"}, true))
+    assert_equal(1, tx16:send(rx16:address(), {string.char(0xEA, 0x82).."123456789"}, true))
+    local valid, invalid = 0, 0
+    while valid + invalid < 3 do
+        local v, i = assert(rx16:recv(1000))
+        assert(v + i > 0, "timed out")
+        valid, invalid = valid + v, invalid + i
+    end
+    assert_equal(2, valid)
+    assert_equal(1, invalid)
+
+    assert_error(function() tx:send(addr, {"ok", 42}) end)
+
+    rx:close()
+    assert_error(function() rx:recv(0) end)
+    assert_error(function() bcrc.udp_validator("127.0.0.1") end)
+    assert_error(function() bcrc.udp_validator("localhost:0") end)
+end
+
+local function pack(n, size, little)
+    local bytes = {}
+    for i = 1, size do
+        bytes[i] = n % 256
+        n = math.floor(n / 256)
+    end
+    if not little then
+        for i = 1, math.floor(size / 2) do
+            bytes[i], bytes[size + 1 - i] = bytes[size + 1 - i], bytes[i]
+        end
+    end
+    return string.char(unpack(bytes))
+end
+
+function test_records()
+    local crc = bcrc.crc32()
+    local function record(payload, sum)
+        return pack(#payload, 4, true)..payload..pack(sum or crc(payload), 4, true)
+    end
+    local stream = record("123456789")..record("", 5)..record("abc", 1)..record("xyz")
+    local checksums, failures, tail = bcrc.records(stream, {data=true})
+    assert_equal(16, #checksums)
+    assert_equal(pack(0xCBF43926, 4), checksums:sub(1, 4))
+    assert_equal(pack(crc("xyz"), 4), checksums:sub(13, 16))
+    assert_equal(2, #failures)
+    assert_equal(#record("123456789"), failures[1])
+    assert_equal(#stream, tail)
+
+    -- truncated tail, and a file header to skip
+    local checksums, failures, tail = bcrc.records("HDR"..stream:sub(1, -2), {data=true, skip=3})
+    assert_equal(12, #checksums)
+    assert_equal(3 + #stream - #record("xyz"), tail)
+
+    -- u16be length, crc-16 at the head covering the length and a 2 byte header
+    local dnp = bcrc.new(16, 0x3D65, 0, 0xffff, true, true)
+    local rec = pack(5, 2)..pack(dnp(pack(5, 2).."HH12345"), 2, true).."HH12345"
+    local checksums, failures, tail = bcrc.records(rec..rec, {data=true, crc=dnp,
+        length_field="u16be", header=2, crc_at="head", cover_length=true})
+    assert_equal(4, #checksums)
+    assert_equal(0, #failures)
+    assert_equal(2 * #rec, tail)
+
+    -- compute only, from a file
+    local path = os.tmpname()
+    local f = assert(io.open(path, "wb"))
+    f:write(pack(9, 1).."123456789"..pack(0, 1))
+    f:close()
+    local checksums, failures, tail = bcrc.records(path, {length_field="u8", crc_at="none"})
+    os.remove(path)
+    assert_equal(pack(0xCBF43926, 4)..pack(0, 4), checksums)
+    assert_equal(0, #failures)
+    assert_equal(11, tail)
+
+    assert_nil(bcrc.records(path))
+    assert_error(function() bcrc.records(stream, {data=true, length_field="u24"}) end)
+end
+
+function test_shard()
+    local keys = {}
+    for i = 1, 1000 do
+        keys[i] = "session-"..i
+    end
+
+    local shards = bcrc.shard(keys, 8)
+    assert_equal(1000, #shards)
+    for i = 1, 1000 do
+        assert(shards[i] >= 1 and shards[i] <= 8)
+    end
+    assert_equal(shards[1], bcrc.shard({keys[1]}, 8)[1])
+
+    -- growing from 8 to 9 shards only moves keys to the new shard
+    local moved = 0
+    for i, shard in ipairs(bcrc.shard(keys, 9)) do
+        if shard ~= shards[i] then
+            assert_equal(9, shard)
+            moved = moved + 1
+        end
+    end
+    assert(moved > 50 and moved < 200, moved)
+
+    local buckets = bcrc.shard(keys, 8, {buckets=true, crc=bcrc.crc16()})
+    local total = 0
+    assert_equal(8, #buckets)
+    for shard, bucket in ipairs(buckets) do
+        total = total + #bucket
+    end
+    assert_equal(1000, total)
+
+    assert_equal(1, bcrc.shard({"a", "b"}, 1)[2])
+    assert_error(function() bcrc.shard(keys, 0) end)
+    assert_error(function() bcrc.shard({{}}, 2) end)
+end
+
+function test_ring_consumer()
+    local name = "/bcrc-test-"..os.time()
+    local crc = bcrc.crc32()
+    local producer = assert(bcrc.ring_producer(name, 256))
+    local consumer = assert(bcrc.ring_consumer(name, {crc=crc}))
+
+    assert_error(function() bcrc.ring_producer(name, 100) end)
+
+    local function frame(payload, sum)
+        return payload..pack(sum or crc(payload), 4, true)
+    end
+
+    assert_true(producer:push(frame("123456789")))
+    assert_true(producer:push(frame("hello", 0)))
+    assert_true(producer:push(frame("")))
+
+    local count, failures = consumer:poll()
+    assert_equal(3, count)
+    assert_equal(1, #failures)
+    assert_equal(2, failures[1])
+    assert_equal(0, consumer:poll())
+
+    -- wrap around the end of the data area, and fill the ring up
+    local pushed = 0
+    while producer:push(frame(string.rep("x", 50))) do
+        pushed = pushed + 1
+    end
+    assert_equal(3, pushed)
+    assert_equal(2, consumer:poll(2))
+    assert_true(producer:push(frame(string.rep("x", 50))))
+    local count, failures = consumer:poll()
+    assert_equal(2, count)
+    assert_equal(0, #failures)
+
+    -- compute mode, publishing to an output ring
+    local outname = name.."-out"
+    local out = assert(bcrc.ring_producer(outname, 1024))
+    local computer = assert(bcrc.ring_consumer(name, {mode="compute", output=outname}))
+    local reader = assert(bcrc.ring_consumer(outname, {mode="none"}))
+    assert_true(producer:push("123456789"))
+    assert_equal(1, computer:poll())
+    local results = reader:read()
+    assert_equal(1, #results)
+    assert_equal(pack(0xCBF43926, 8, true)..pack(9, 4, true)..pack(1, 4, true), results[1])
+
+    assert_true(producer:push("123456789"))
+    local crcs = assert(bcrc.ring_consumer(name, {mode="compute"})):poll()
+    assert_equal(1, #crcs)
+    assert_equal(0xCBF43926, crcs[1])
+
+    -- frames shorter than the crc fail, with a checksum of 0
+    local verifier = assert(bcrc.ring_consumer(name, {crc=crc, output=outname}))
+    assert_true(producer:push(frame("123456789")))
+    assert_true(producer:push("ab"))
+    assert_equal(2, verifier:poll())
+    local results = reader:read()
+    assert_equal(2, #results)
+    assert_equal(pack(0xCBF43926, 8, true)..pack(13, 4, true)..pack(1, 4, true), results[1])
+    assert_equal(pack(0, 8, true)..pack(2, 4, true)..pack(0, 4, true), results[2])
+
+    assert_true(bcrc.ring_unlink(name))
+    assert_true(bcrc.ring_unlink(outname))
+    assert_nil(bcrc.ring_consumer(name))
+end
+
+function test_ring_corrupt()
+    local name = "/bcrc-test-corrupt-"..os.time()
+    local producer = assert(bcrc.ring_producer(name, 256))
+    local consumer = assert(bcrc.ring_consumer(name, {crc=bcrc.crc32()}))
+    local shm = io.open("/dev/shm"..name, "r+b")
+
+    -- a frame longer than what was published is corrupt
+    if shm then
+        assert_true(producer:push("abc"))
+        shm:seek("set", 192)
+        shm:write(pack(20, 4, true))
+        shm:close()
+        local ok, err, errno = consumer:poll()
+        assert_nil(ok)
+        assert_string(err)
+        assert_number(errno)
+    end
+    assert_error(function() bcrc.ring_consumer(name, {output=42}) end)
+
+    assert_true(bcrc.ring_unlink(name))
+end
+
+local function xor(a, b)
+    local r, bit = 0, 1
+    while a > 0 or b > 0 do
+        if a % 2 ~= b % 2 then
+            r = r + bit
+        end
+        a, b, bit = math.floor(a / 2), math.floor(b / 2), bit * 2
+    end
+    return r
+end
+
+function test_polynomial_arithmetic()
+    local crc32 = bcrc.crc32()
+    local ccitt = bcrc.ccitt()
+
+    assert_equal(0x80000000, crc32:xpow(0))
+    assert_equal(0xEDB88320, crc32:xpow(32))
+    assert_equal(1, ccitt:xpow(0))
+    assert_equal(0x1021, ccitt:xpow(16))
+    assert_equal(ccitt:xpow(1000), ccitt:mulmod(ccitt:xpow(400), ccitt:xpow(600)))
+    assert_equal(crc32:xpow(123456789), crc32:mulmod(crc32:xpow(123456700), crc32:xpow(89)))
+    assert_equal(crc32:xpow(8 * 5 + 3), crc32:shift(crc32:xpow(3), 5))
+
+    -- combine, as in zlib's crc32_combine(), for init == xor == 0xFFFFFFFF
+    local combined = xor(crc32:shift(crc32("1234"), 5), crc32("56789"))
+    assert_equal(0xCBF43926, combined)
+
+    assert_equal(0x80, crc32:reflect(1, 8))
+    assert_equal(0xEDB88320, crc32:reflect(0x04C11DB7))
+    assert_equal(0x8408, ccitt:reflect(0x1021))
+    assert_error(function() crc32:xpow(-1) end)
+end
+
+function test_shadow()
+    local crc = bcrc.crc32()
+    local mismatches = 0
+    assert_equal(crc, crc:shadow(2, function() mismatches = mismatches + 1 end))
+    for i = 1, 5 do
+        assert_equal(0xCBF43926, crc("123456789"))
+    end
+    crc:reset():process("1234"):process("56789")
+    assert_equal(0xCBF43926, crc:checksum())
+    local samples, mismatched = crc:shadow_stats()
+    assert_equal(3, samples)
+    assert_equal(0, mismatched)
+    assert_equal(0, mismatches)
+
+    crc:shadow(0)
+    assert_equal(0, crc:shadow_stats())
+
+    local basic = bcrc.new(24, 0x864CFB, 0xB704CE, 0, false, false):shadow(1)
+    assert_equal(0x21CF02, basic("123456789"))
+    assert_equal(1, basic:shadow_stats())
+
+    assert_error(function() crc:shadow(-1) end)
+    assert_error(function() crc:shadow(1, 2) end)
+end
+
+function test_copy()
+    local crc = bcrc.crc32()
+    local buffer = bcrc.buffer(16)
+    assert_equal(16, #buffer)
+    assert_equal(string.rep("\0", 16), buffer:tostring())
+
+    assert_equal(crc, crc:reset():copy(buffer, 2, "xx123456789", 3))
+    assert_equal(0xCBF43926, crc:checksum())
+    assert_equal("\0\0".."123456789".."\0\0\0\0\0", buffer:tostring())
+    assert_equal("123", buffer:tostring(3, 5))
+    assert_equal(0xCBF43926, crc(buffer, 3, 11))
+
+    -- buffer to buffer, large enough to use streaming stores
+    local big = string.rep("0123456789abcdef", 40000)
+    local src = bcrc.buffer(#big)
+    local dst = bcrc.buffer(#big + 1)
+    crc:reset():copy(src, 0, big)
+    crc:reset():copy(dst, 1, src, 2)
+    assert_equal(crc(big, 2), crc:checksum())
+    assert(big:sub(2) == dst:tostring(2, #big))
+
+    assert_error(function() crc:copy(buffer, 10, "1234567") end)
+    assert_error(function() crc:copy(buffer, -1, "") end)
+    assert_error(function() crc:copy("string", 0, "") end)
+    assert_error(function() crc:copy(crc, 0, "") end)
+end
+
+function test_t10pi()
+    -- CRC-16/T10-DIF check value, from the catalogue
+    assert_equal(0xD0DB, bcrc.t10dif()("123456789"))
+    assert_equal(0xD0DB, bcrc.new(16, 0x8BB7, 0, 0, false, false)("123456789"))
+
+    local sectors = {}
+    for i = 1, 9 do
+        sectors[i] = string.rep(string.char(i * 7 % 256, i, 255 - i, 3), 128)
+    end
+    local image = table.concat(sectors)
+    local t10 = bcrc.t10dif()
+
+    local pi = bcrc.t10pi(image, {data=true, ref_tag_start=100, app_tag=0x1234, threads=4})
+    assert_equal(9 * 8, #pi)
+    for i = 1, 9 do
+        assert_equal(pack(t10(sectors[i]), 2)..pack(0x1234, 2)..pack(99 + i, 4), pi:sub(i * 8 - 7, i * 8))
+    end
+
+    local formatted = bcrc.t10pi(image.."partial", {data=true, interleaved=true, ref_tag_start=100})
+    assert_equal(9 * 520, #formatted)
+
+    assert_equal(0, #bcrc.t10pi(formatted, {data=true, mode="verify", ref_tag_start=100}))
+    assert_equal(0, #bcrc.t10pi(image, {data=true, mode="verify", pi=pi, ref_tag_start=100, threads=1}))
+    local buffer = bcrc.buffer(#pi)
+    bcrc.crc32():copy(buffer, 0, pi)
+    assert_equal(0, #bcrc.t10pi(image, {data=true, mode="verify", pi=buffer, ref_tag_start=100}))
+    assert_error(function() bcrc.t10pi(image, {data=true, mode="verify", pi={}}) end)
+    assert_error(function() bcrc.t10pi(image, {data=true, mode="verify", pi=8}) end)
+
+    -- corrupt sector 3's data, and sector 6's reference tag
+    local bad = formatted:sub(1, 2 * 520 + 10).."X"..formatted:sub(2 * 520 + 12, 5 * 520 + 519)
+        ..pack(0, 1)..formatted:sub(5 * 520 + 521)
+    assert_equal(#formatted, #bad)
+    local failures = bcrc.t10pi(bad, {data=true, mode="verify", ref_tag_start=100})
+    assert_equal(2, #failures)
+    assert_equal(2, failures[1])
+    assert_equal(5, failures[2])
+    assert_equal(1, #bcrc.t10pi(bad, {data=true, mode="verify", ref_tag_start=100, check_ref=false}))
+
+    -- 4096 byte sectors from a file
+    local path = os.tmpname()
+    local f = assert(io.open(path, "wb"))
+    f:write(string.rep(image, 8))
+    f:close()
+    local pi = bcrc.t10pi(path, {sector=4096})
+    os.remove(path)
+    assert_equal(9 * 8, #pi)
+    assert_equal(pack(t10(string.rep(image, 8):sub(1, 4096)), 2), pi:sub(1, 2))
+
+    -- sectors that aren't a multiple of 16 bytes
+    local pi = bcrc.t10pi(image, {data=true, sector=100})
+    for i = 1, #image / 100 do
+        assert_equal(pack(t10(image:sub(i * 100 - 99, i * 100)), 2), pi:sub(i * 8 - 7, i * 8 - 6))
+    end
+end
+
+function test_delta()
+    local function patch(old, ops)
+        local out = {}
+        for i, op in ipairs(ops) do
+            if type(op) == "string" then
+                out[i] = op
+            else
+                out[i] = old:sub(op[1] + 1, op[1] + op[2])
+            end
+        end
+        return table.concat(out)
+    end
+
+    local blocks = {}
+    for i = 1, 300 do
+        blocks[i] = string.format("block %04d of the old firmware image|", i)
+    end
+    local old = table.concat(blocks)
+
+    -- insert, delete and modify at unaligned offsets
+    local new = "HEADER!"..old:sub(1, 3000).."inserted"..old:sub(3100, 9000)
+        .."x"..old:sub(9002).."trailer"
+
+    for _, threads in ipairs({1, 3, 8}) do
+        local ops, matched = bcrc.delta(old, new, 64, {data=true, threads=threads})
+        assert(new == patch(old, ops), "threads "..threads)
+        assert(matched > #new - 64 * 8, matched)
+        assert(#ops < 20)
+    end
+
+    -- regions without matches give the same ops as a serial scan
+    local noise = bcrc.prbs(23):generate(40000)
+    for _, new in ipairs({noise, old:sub(1, 500)..noise..old:sub(5000, 5600)}) do
+        local serial = bcrc.delta(old, new, 64, {data=true, threads=1})
+        assert(new == patch(old, serial))
+        for _, threads in ipairs({3, 8}) do
+            local ops = bcrc.delta(old, new, 64, {data=true, threads=threads})
+            assert_equal(#serial, #ops, "threads "..threads)
+            for i, op in ipairs(serial) do
+                if type(op) == "string" then
+                    assert_equal(op, ops[i])
+                else
+                    assert_equal(op[1], ops[i][1])
+                    assert_equal(op[2], ops[i][2])
+                end
+            end
+        end
+    end
+
+    -- identical files are one copy, when the last block is whole
+    local ops, matched = bcrc.delta(old, old, 37, {data=true})
+    assert_equal(1, #ops)
+    assert_equal(0, ops[1][1])
+    assert_equal(#old, ops[1][2])
+    assert_equal(#old, matched)
+
+    -- nothing in common, or too short to match
+    local ops, matched = bcrc.delta(old, "short", 64, {data=true})
+    assert_equal("short", ops[1])
+    assert_equal(0, matched)
+    assert_equal(0, #bcrc.delta("", "", 64, {data=true}))
+
+    local path = os.tmpname()
+    local f = assert(io.open(path, "wb"))
+    f:write(old)
+    f:close()
+    local ops = bcrc.delta(path, path, 64)
+    os.remove(path)
+    assert_equal(#old - #old % 64, ops[1][2])
+    assert_equal(old:sub(#old - #old % 64 + 1), ops[2])
+end
+
+function test_prbs()
+    local function bits(bytes)
+        local b = {}
+        for i = 1, #bytes do
+            local v = bytes:byte(i)
+            for k = 7, 0, -1 do
+                b[#b + 1] = math.floor(v / 2^k) % 2
+            end
+        end
+        return b
+    end
+
+    -- each bit is the xor of the bits at the delays of the polynomial's terms
+    for order, delay in pairs({[7]=6, [9]=5, [15]=14, [23]=18, [31]=28}) do
+        local b = bits(bcrc.prbs(order):generate(200))
+        for i = order + 1, #b do
+            assert(b[i] == xor(b[i - order], b[i - delay]), order)
+        end
+    end
+
+    -- PRBS7 is maximal length, each period of 127 bits has 64 ones
+    local p = bcrc.prbs(7)
+    local seq = p:generate(127)
+    assert_equal(seq, p:generate(127))
+    local ones = 0
+    for _, v in ipairs(bits(seq)) do ones = ones + v end
+    assert_equal(8 * 64, ones)
+
+    -- a custom polynomial, and the generator continues across calls
+    local p = bcrc.prbs(31, {poly=0x10000001, seed=0x12345, invert=true})
+    local q = bcrc.prbs(31, {seed=0x12345, invert=true})
+    assert_equal(q:generate(1000), p:generate(300)..p:generate(700))
+    assert_error(function() bcrc.prbs(13) end)
+    assert_error(function() bcrc.prbs(65, {poly=1}) end)
+
+    -- the checker syncs on the first bytes, and counts each bit error once
+    local q = bcrc.prbs(23, {invert=true})
+    local seq = bcrc.prbs(23, {invert=true, seed=77}):generate(5000)
+    local errors, checked = q:check(seq)
+    assert_equal(0, errors)
+    assert_equal((5000 - 3) * 8, checked)
+
+    local bad = seq:sub(1, 99)..string.char(xor(seq:byte(100), 0x81))..seq:sub(101, 4000)
+        ..string.char(xor(seq:byte(4001), 0x10))..seq:sub(4002)
+    q:sync()
+    assert_equal(3, q:check(bad, 1, 2500) + q:check(bad, 2501))
+
+    local errors, checked = bcrc.prbs(23):check(seq)
+    assert(errors > checked / 3)
+end
+
+function test_firmware()
+    local function record(prefix, bytes, ones)
+        local sum = 0
+        for i = 1, #bytes do sum = sum + bytes:byte(i) end
+        sum = ones and 255 - sum % 256 or (256 - sum % 256) % 256
+        return prefix..(bytes..string.char(sum)):gsub(".", function(c)
+            return string.format("%02X", c:byte())
+        end)
+    end
+    local function ihex(type, address, data)
+        return record(":", string.char(#data)..pack(address, 2)..string.char(type)..data)
+    end
+    local function srec(type, address, data)
+        local abytes = ({[0]=2, 2, 3, 4, [7]=4, [8]=3, [9]=2})[type]
+        return record("S"..type, string.char(abytes + #data + 1)..pack(address, abytes)..data, true)
+    end
+
+    local a = ("firmware"):rep(40)
+    local b = ("more"):rep(10)
+    local hex = {
+        ihex(4, 0, "\0\1"),                             -- base 0x10000
+        ihex(0, 0x100, a:sub(1, 200)),
+        ihex(0, 0x100 + 200, a:sub(201)),
+        ihex(2, 0, "\240\0"),                           -- base 0xF0000
+        ihex(0, 0, b),
+        ihex(5, 0, pack(0x10123, 4)),
+        ihex(1, 0, ""),
+        "garbage after the end",
+    }
+    local image = bcrc.firmware.load(table.concat(hex, "\r\n"), {data=true})
+    assert_equal(2, #image.segments)
+    assert_equal(0x10100, image.segments[1][1])
+    assert_equal(a, image.segments[1][2])
+    assert_equal(0xF0000, image.segments[2][1])
+    assert_equal(b, image.segments[2][2])
+    assert_equal(0x10123, image.start)
+
+    -- gaps are filled, default range is the whole image
+    local flat = a..string.rep("\255", 0xF0000 - 0x10100 - #a)..b
+    assert_equal(bcrc.crc32()(flat), image.crc)
+
+    -- the same image as S-records, with a crc of given ranges
+    local s = {
+        srec(0, 0, "header"),
+        srec(3, 0xF0000, b),
+        srec(2, 0x10100 + 160, a:sub(161)),
+        srec(2, 0x10100, a:sub(1, 160)),
+        srec(7, 0x10123, ""),
+    }
+    for _, crc in ipairs({bcrc.crc32(), bcrc.xmodem()}) do
+        local image = bcrc.firmware.load(table.concat(s, "\n"),
+            {data=true, crc=crc, fill=0, ranges={{0x10000, 0x200}, {0xF0010, 0x1000}}})
+        local flat = ("\0"):rep(0x100)..a:sub(1, 0x100)
+            ..b:sub(17)..("\0"):rep(0x1000 - #b + 16)
+        assert_equal(crc(flat), image.crc)
+        assert_equal(0x10123, image.start)
+    end
+
+    -- bad records
+    local bad = ihex(0, 0, "abc"):sub(1, -2).."0"
+    local image, err, line = bcrc.firmware.load(hex[1].."\n"..bad, {data=true})
+    assert_nil(image)
+    assert_equal("line 2: bad checksum", err)
+    assert_equal(2, line)
+    assert_nil(bcrc.firmware.load(ihex(0, 0, "abc").."\n"..ihex(0, 1, "b"), {data=true}))
+    assert_nil(bcrc.firmware.load("S1zz", {data=true}))
+    assert_nil(bcrc.firmware.load("/nonexistent.hex"))
+end
+
+function test_relay()
+    local data = {}
+    for i = 1, 30000 do data[i] = string.format("%05d ", i) end
+    data = table.concat(data)
+
+    local src = os.tmpname()
+    local dst = os.tmpname()
+    local f = assert(io.open(src, "wb"))
+    f:write(data)
+    f:close()
+
+    local function slurp(path)
+        local f = assert(io.open(path, "rb"))
+        local s = f:read("*a")
+        f:close()
+        return s
+    end
+
+    -- from a file, in two parts
+    local i = assert(io.open(src, "rb"))
+    local o = assert(io.open(dst, "wb"))
+    local crc = bcrc.crc32()
+    assert_equal(100000, bcrc.relay(i, o, crc, {len=100000}))
+    local n, sum = bcrc.relay(i, o, crc)
+    assert_equal(#data - 100000, n)
+    assert_equal(bcrc.crc32()(data), sum)
+    i:close()
+    o:close()
+    assert_equal(data, slurp(dst))
+
+    -- from a file to a pipe
+    local i = assert(io.open(src, "rb"))
+    local o = assert(io.popen("cat > "..dst, "w"))
+    local n, sum = bcrc.relay(i, o, bcrc.xmodem())
+    i:close()
+    o:close()
+    assert_equal(#data, n)
+    assert_equal(bcrc.xmodem()(data), sum)
+    assert_equal(data, slurp(dst))
+
+    -- from a pipe to a file
+    local i = assert(io.popen("cat "..src.." 2>/dev/null", "r"))
+    local o = assert(io.open(dst, "wb"))
+    local n, sum = bcrc.relay(i, o, bcrc.crc32(), {len=123456})
+    i:close()
+    o:close()
+    assert_equal(123456, n)
+    assert_equal(bcrc.crc32()(data:sub(1, 123456)), sum)
+    assert_equal(data:sub(1, 123456), slurp(dst))
+
+    os.remove(src)
+    os.remove(dst)
+
+    local i = assert(io.open("/dev/null", "rb"))
+    assert_equal(0, bcrc.relay(i, 1, bcrc.crc32()))
+    i:close()
+    assert_nil(bcrc.relay(-1, 1, bcrc.crc32()))
+end
+
+function test_small_appends()
+    local data = {}
+    for i = 1, 500 do data[i] = string.format("%d,", i * i) end
+    data = table.concat(data)
+
+    for _, make in ipairs({bcrc.crc32, bcrc.xmodem, function()
+        return bcrc.new(24, 0x864CFB, 0xB704CE, 0, false, false)
+    end}) do
+        local crc = make()
+        local at = 1
+        local sizes = {1, 3, 8, 2, 16, 17, 0, 5, 100, 1}
+        local k = 0
+        while at <= #data do
+            k = k % #sizes + 1
+            crc:process(data, at, at + sizes[k] - 1)
+            at = at + sizes[k]
+            -- the staged bytes count whenever the crc is read
+            if k == 4 then
+                assert_equal(make()(data:sub(1, at - 1)), crc:checksum())
+            end
+        end
+        assert_equal(make()(data), crc:checksum())
+        assert_equal(make()(data), crc:checksum())
+
+        crc:process("abc")
+        crc:reset()
+        assert_equal(make()(""), crc:checksum())
+    end
+end
+
+function test_verify_many()
+    -- crc, its width in bytes, and whether it is little endian by default
+    local crcs = {
+        {bcrc.crc32(), 4, true},
+        {bcrc.xmodem(), 2, true},
+        {bcrc.crc16(), 2, true},
+        {bcrc.new(8, 0x07, 0, 0, false, false), 1, false},
+        {bcrc.new(24, 0x864CFB, 0xB704CE, 0, false, false), 3, false},
+        {bcrc.new(24, 0x5D6DCB, 0xFEDCBA, 0x123456, true, false), 3, false},
+    }
+
+    for _, c in ipairs(crcs) do
+        local crc, width, little = c[1], c[2], c[3]
+        for _, opts in ipairs({{}, {crc_pos="head", endian="little"}, {endian="big"}}) do
+            local frames = {}
+            local expect = {}
+            for i = 1, 37 do
+                local payload = string.rep(string.char(i), i % 9 * 7)..tostring(i)
+                local packed = pack(crc(payload), width, opts.endian == "little" or not opts.endian and little)
+                local frame = opts.crc_pos == "head" and packed..payload or payload..packed
+                if i % 5 == 0 then
+                    frame = frame:sub(1, -2)..string.char(xor(frame:byte(-1), 1))
+                    expect[#expect + 1] = i
+                end
+                frames[i] = frame
+            end
+            frames[38] = ""
+            expect[#expect + 1] = 38
+
+            local failures, list = crc:verify_many(frames, {crc_pos=opts.crc_pos, endian=opts.endian, list=true})
+            assert_equal(#expect, failures)
+            assert_equal(table.concat(expect, ","), table.concat(list, ","))
+
+            local failures, bitmap = crc:verify_many(frames, opts)
+            assert_equal(#expect, failures)
+            assert_equal(5, #bitmap)
+            for i = 1, 38 do
+                local bit = math.floor(bitmap:byte(math.floor((i - 1) / 8) + 1) / 2^((i - 1) % 8)) % 2
+                assert_equal(i % 5 == 0 or i == 38, bit == 1)
+            end
+        end
+    end
+
+    assert_equal(0, bcrc.crc32():verify_many({}))
+    assert_error(function() bcrc.crc32():verify_many({1}) end)
+end
+
+function test_shared_tables()
+    -- check values of the crc catalogue
+    local check = {
+        {{5, 0x05, 0x1F, 0x1F, true, true}, 0x19},
+        {{12, 0x80F, 0, 0, false, true}, 0xDAF},
+        {{16, 0x1021, 0xFFFF, 0, false, false}, 0x29B1},
+        {{24, 0x864CFB, 0xB704CE, 0, false, false}, 0x21CF02},
+        {{32, 0x04C11DB7, 0xFFFFFFFF, 0, false, false}, 0x0376E6E7},
+        {{32, 0x04C11DB7, 0xFFFFFFFF, 0xFFFFFFFF, true, true}, 0xCBF43926},
+    }
+    for _, c in ipairs(check) do
+        local p = c[1]
+        local crc = bcrc.new(p[1], p[2], p[3], p[4], p[5], p[6], {shared=true})
+        assert_equal(c[2], crc("123456789"))
+        -- a second object maps the same table
+        local again = bcrc.new(p[1], p[2], p[3], p[4], p[5], p[6], {shared=true})
+        assert_equal(c[2], again:process("1234"):process("56789"):checksum())
+    end
+
+    local basic = bcrc.new(16, 0x8005, 0x1234, 0x5678, true, false)
+    local shared = bcrc.new(16, 0x8005, 0x1234, 0x5678, true, false, {shared=true})
+    local data = string.rep("shared tables ", 100)
+    assert_equal(basic(data), shared(data))
+    assert_equal(basic:xpow(1000), shared:xpow(1000))
+    assert_error(function() bcrc.new(33, 1, 0, 0, false, false, {shared=true}) end)
+
+    -- remove the segments, the crcs keep their mappings
+    for _, c in ipairs(check) do
+        local p = c[1]
+        assert_true(bcrc.shared_unlink(p[1], p[2], p[5]))
+    end
+    assert_true(bcrc.shared_unlink(16, 0x8005, true))
+    assert_nil(bcrc.shared_unlink(16, 0x8005, true))
+    assert_equal(basic(data), shared(data))
+end
+
+function test_chunker()
+    local function random(n, seed)
+        local t = {}
+        local x = seed
+        for i = 1, n do
+            x = (x * 1103515245 + 12345) % 2147483648
+            t[i] = string.char(math.floor(x / 65536) % 256)
+        end
+        return table.concat(t)
+    end
+    local function chunks(chunker, data, step)
+        local cuts, fps = {}, {}
+        local function add(c, f)
+            for i = 1, #c do
+                cuts[#cuts + 1] = c[i]
+                fps[#fps + 1] = f[i]
+            end
+        end
+        for i = 1, #data, step do
+            add(chunker:feed(data, i, i + step - 1))
+        end
+        add(chunker:finish())
+        return cuts, fps
+    end
+
+    local block = random(64 * 1024, 7)
+    local data = random(1500 * 1024, 1)..block..block
+
+    -- in one go, in pieces, and with parallel scanning, the chunks are the same
+    local cuts, fps = chunks(bcrc.chunker({threads=1}), data, #data)
+    local cuts2, fps2 = chunks(bcrc.chunker({threads=1}), data, 1000)
+    local cuts3, fps3 = chunks(bcrc.chunker({threads=8}), data, 700 * 1024)
+    assert_equal(table.concat(cuts, ","), table.concat(cuts2, ","))
+    assert_equal(table.concat(cuts, ","), table.concat(cuts3, ","))
+    assert_equal(table.concat(fps), table.concat(fps2))
+    assert_equal(table.concat(fps), table.concat(fps3))
+
+    assert_equal(#data, cuts[#cuts])
+    local avg = #data / #cuts
+    assert(avg > 6000 and avg < 14000, avg)
+    local at = 0
+    for i, cut in ipairs(cuts) do
+        assert(cut - at <= 65536)
+        assert(cut - at >= 2048 or i == #cuts)
+        assert_equal(8, #fps[i])
+        at = cut
+    end
+
+    -- the repeated block is chunked the same, after the first cut in it
+    local seen, dups = {}, 0
+    for _, fp in ipairs(fps) do
+        if seen[fp] then dups = dups + 1 end
+        seen[fp] = true
+    end
+    assert(dups >= 4, dups)
+
+    -- inserting bytes only changes the chunks around them
+    local cutsi, fpsi = chunks(bcrc.chunker(), "inserted"..data, 4096)
+    local same = 0
+    for _, fp in ipairs(fpsi) do
+        if seen[fp] then same = same + 1 end
+    end
+    assert(same >= #fps - 3, same)
+
+    -- fingerprints are CRC-64/XZ, or the given crc
+    local c = bcrc.chunker()
+    c:feed("123456789")
+    local cuts, fps = c:finish()
+    assert_equal(9, cuts[1])
+    assert_equal(pack(0x995DC9BB, 4)..pack(0xDF1939FA, 4), fps[1])
+
+    local cuts, fps = chunks(bcrc.chunker({crc=bcrc.xmodem(), min=100, avg=200, max=300}), data:sub(1, 5000), 5000)
+    assert_equal(pack(bcrc.xmodem()(data:sub(cuts[1] + 1, cuts[2])), 2), fps[2])
+
+    assert_error(function() bcrc.chunker({min=100, avg=50}) end)
+end
+
+function test_pcap_writer()
+    local function u16(s, at) return s:byte(at) * 256 + s:byte(at + 1) end
+    local function u32le(s, at)
+        return s:byte(at) + s:byte(at + 1) * 256 + s:byte(at + 2) * 65536 + s:byte(at + 3) * 16777216
+    end
+    local function onesum(s, total)
+        total = total or 0
+        if #s % 2 == 1 then s = s.."\0" end
+        for i = 1, #s, 2 do total = total + u16(s, i) end
+        while total > 65535 do total = total % 65536 + math.floor(total / 65536) end
+        return total
+    end
+
+    -- Ethernet, a VLAN tag, IPv4 and UDP, with zeroed checksums and crc
+    local payload = "application payload".."\0\0\0\0"
+    local udp = pack(1234, 2)..pack(5678, 2)..pack(8 + #payload, 2).."\0\0"..payload
+    local ip = "\69\0"..pack(20 + #udp, 2).."\0\1\64\0\64\17\0\0"
+        .."\10\0\0\1".."\10\0\0\2"
+    local frame = ("\2"):rep(6)..("\4"):rep(6).."\129\0\0\5\8\0"..ip..udp
+
+    local path = os.tmpname()
+    local w = assert(bcrc.pcap_writer(path, {fcs=true, crc=bcrc.crc32(), start=1000, interval=0.5}))
+    assert_equal(w, w:write(frame))
+    assert_equal(w, w:write(frame, {{18 + 20, 4321, 2}, {18 + 28, "APP"}}, 2000.25))
+    assert_equal(2, w:write_many({frame, frame}))
+    assert_equal(3, w:generate(frame, 3, {{18 + 4, 2, 1}}))
+    assert_equal(7, w:close())
+
+    local f = assert(io.open(path, "rb"))
+    local pcap = f:read("*a")
+    f:close()
+    os.remove(path)
+
+    assert_equal(0xA1B2C3D4, u32le(pcap, 1))
+    assert_equal(1, u32le(pcap, 21))
+    local at = 25
+    local packets = {}
+    while at <= #pcap do
+        local sec, usec, incl, len = u32le(pcap, at), u32le(pcap, at + 4), u32le(pcap, at + 8), u32le(pcap, at + 12)
+        assert_equal(incl, len)
+        packets[#packets + 1] = {sec + usec / 1e6, pcap:sub(at + 16, at + 15 + incl)}
+        at = at + 16 + incl
+    end
+    assert_equal(7, #packets)
+    assert_equal(1000, packets[1][1])
+    assert_equal(2000.25, packets[2][1])
+    assert_equal(1001, packets[3][1])
+
+    for i, p in ipairs(packets) do
+        local pkt = p[2]
+        assert_equal(#frame + 4, #pkt)
+        -- FCS
+        assert_equal(bcrc.crc32()(pkt:sub(1, -5)), u32le(pkt, #pkt - 3))
+        -- IPv4 header
+        local ip = pkt:sub(19, 38)
+        assert_equal(0xFFFF, onesum(ip))
+        assert_equal(i > 4 and i - 5 or 0, u16(ip, 5) - 1)
+        -- UDP, over a pseudo header
+        local udp = pkt:sub(39, -5)
+        assert_equal(0xFFFF, onesum(udp, onesum(ip:sub(13, 20)) + 17 + #udp))
+        -- application crc, little endian at the end of the payload
+        local payload = udp:sub(9)
+        assert_equal(bcrc.crc32()(payload:sub(1, -5)), u32le(payload, #payload - 3))
+    end
+    assert_equal(4321, u16(packets[2][2], 39))
+    assert_equal("APP", packets[2][2]:sub(47, 49))
+
+    local w = assert(bcrc.pcap_writer(path))
+    assert_error(function() w:write(frame, {{0, -1, 2}}) end)
+    assert_error(function() w:write(frame, {{0, 65536, 2}}) end)
+    assert_error(function() w:write(frame, {{0, 1.5, 2}}) end)
+    assert_equal(w, w:write(frame, {{0, 65535, 2}}))
+    w:close()
+    os.remove(path)
+
+    assert_nil(bcrc.pcap_writer("/nonexistent/dir/x.pcap"))
+
+    -- once a write fails, every call reports it and nothing more is buffered
+    local f = io.open("/dev/full", "wb")
+    if f then
+        f:close()
+        w = assert(bcrc.pcap_writer("/dev/full"))
+        local big = {}
+        for i = 1, 1000 do big[i] = ("\0"):rep(1500) end
+        local ok, err, errno
+        for i = 1, 20 do
+            ok, err, errno = w:write_many(big)
+        end
+        assert_nil(ok)
+        assert_string(err)
+        assert_number(errno)
+        assert_nil(w:write(frame))
+        assert_nil(w:generate(frame, 3))
+        ok, err, errno = w:flush()
+        assert_nil(ok)
+        assert_string(err)
+        assert_number(errno)
+        assert_nil(w:close())
+    end
+end
+
+function test_simulate()
+    local crc8 = bcrc.new(8, 0x07)
+
+    -- a crc of r bits detects every burst of r bits or less
+    local undetected, errored = bcrc.simulate(crc8, {burst_len=8, trials=100000})
+    assert_equal(0, undetected)
+    assert_equal(100000, errored)
+
+    -- and misses 1 in 2^(r-1) bursts of r+1 bits, 1 in 2^r of those longer
+    undetected, errored = bcrc.simulate(crc8, {burst_len=9, trials=1000000})
+    assert_equal(1000000, errored)
+    assert_true(math.abs(undetected / errored - 1/128) < 0.001)
+    undetected, errored = bcrc.simulate(crc8, {burst_len=40, len=16, trials=1000000})
+    assert_true(math.abs(undetected / errored - 1/256) < 0.0005)
+
+    -- with every bit as likely to be in error as not, 1 in 2^r errors is missed
+    undetected, errored = bcrc.simulate(crc8, {ber=0.5, len=8, trials=1000000})
+    assert_equal(1000000, errored)
+    assert_true(math.abs(undetected / errored - 1/256) < 0.0005)
+
+    -- at a low ber most codewords have no errors, and cost nothing
+    local u1, e1 = bcrc.simulate(crc8, {ber=1e-9, trials=1e10, threads=1, seed=7})
+    assert_true(math.abs(e1 / (1e10 * 520 * 1e-9) - 1) < 0.02)
+    local u2, e2 = bcrc.simulate(crc8, {ber=1e-9, trials=1e10, threads=3, seed=7})
+    assert_equal(u1, u2)
+    assert_equal(e1, e2)
+
+    assert_error(function() bcrc.simulate(crc8, {}) end)
+    assert_error(function() bcrc.simulate(crc8, {ber=0.1, burst_len=3}) end)
+end
+
+function test_array()
+    local a = bcrc.array(32, 3)
+    assert_equal(3, #a)
+    assert_equal(0, a[1])
+    assert_nil(a[4])
+    a[1], a[2], a[3], a[4] = 30, 0xFFFFFFFF, 10, 30
+    assert_equal(4, #a)
+    assert_equal(0xFFFFFFFF, a[2])
+    assert_error(function() a[1] = 2^32 end)
+    assert_error(function() a[6] = 1 end)
+    assert_error(function() a:search(10) end)
+
+    assert_equal(a, a:sort())
+    assert_equal(10, a[1])
+    assert_equal(0xFFFFFFFF, a[4])
+    assert_equal(2, a:search(30))
+    assert_nil(a:search(20))
+    assert_equal(1, a:duplicates())
+
+    local b = bcrc.array(16)
+    for i, v in ipairs{10, 20, 30, 30} do b[i] = v end
+    local common = a:intersect(b:sort())
+    assert_equal(2, #common)
+    assert_equal(10, common[1])
+    assert_equal(30, common[2])
+    assert_equal(0, common:duplicates())
+
+    -- checksums of a corpus, appended by bcrc.records()
+    local crc = bcrc.crc32()
+    local stream = ""
+    for i = 1, 100 do
+        local s = tostring(i % 60)
+        stream = stream..pack(#s, 4, true)..s..pack(crc(s), 4, true)
+    end
+    local sums = bcrc.array(32)
+    assert_equal(sums, bcrc.records(stream, {data=true, into=sums}))
+    assert_equal(100, #sums)
+    assert_equal(crc("1"), sums[1])
+    assert_equal(40, sums:sort():duplicates())
+    assert_error(function() bcrc.records(stream, {data=true, into=bcrc.array(16)}) end)
+
+    local big = bcrc.array(64, 1e6)
+    for i = 1, #big, 1000 do big[i] = i end
+    assert_equal(1e6 - 1000 - 1, big:sort():duplicates())
+    assert_equal(1e6, big:search(999001))
+    assert_nil(big:search(2^64))
+    assert_error(function() big[1] = 2^64 end)
+    assert_error(function() big[1] = 0.5 end)
+    big[1] = 2^63
+    assert_equal(2^63, big[1])
+
+    -- checksums of frames, and guard tags of sectors
+    local frames = {"123456789"..pack(0xCBF43926, 4, true), "bad!", "x"}
+    local sums = bcrc.array(32)
+    assert_equal(2, crc:verify_many(frames, {into=sums}))
+    assert_equal(3, #sums)
+    assert_equal(0xCBF43926, sums[1])
+    assert_equal(crc(""), sums[3])
+    assert_error(function() crc:verify_many(frames, {into=bcrc.array(16)}) end)
+
+    local image = string.rep("\0", 512)..string.rep("\1", 512)
+    local guards = bcrc.array(16)
+    local pi = bcrc.t10pi(image, {data=true, into=guards})
+    assert_equal(2, #guards)
+    assert_equal(bcrc.t10dif()(image:sub(513)), guards[2])
+    assert_equal(0, #bcrc.t10pi(image, {data=true, mode="verify", pi=pi, into=guards}))
+    assert_equal(4, #guards)
+    assert_equal(guards[2], guards[4])
+end
+
+function test_journal()
+    local path = os.tmpname()
+    local j = assert(bcrc.journal(path, {group=100, sync=false}))
+    for i = 1, 1000 do
+        assert_equal(j, j:append("record "..i))
+    end
+    assert_equal(j, j:append(""))
+    assert_true(j:close())
+
+    -- readable as records, with the crc covering the length
+    local f = assert(io.open(path, "rb"))
+    local bytes = f:read("*a")
+    f:close()
+    local checksums, failures, tail = bcrc.records(bytes, {data=true, cover_length=true})
+    assert_equal(1001 * 4, #checksums)
+    assert_equal(0, #failures)
+    assert_equal(#bytes, tail)
+
+    -- a torn write, and a corrupt record, after which nothing is trusted
+    local torn = bytes..pack(100, 4, true).."partial"
+    local corrupt = bytes:sub(1, 1000)..string.char(bytes:byte(1001) + 1)..bytes:sub(1002)
+    for _, case in ipairs{{bytes, 1001}, {torn, 1001}, {corrupt, nil}} do
+        f = assert(io.open(path, "wb"))
+        f:write(case[1])
+        f:close()
+        j = assert(bcrc.journal(path, {threads=4}))
+        local records, size = j:recover()
+        if case[2] then
+            assert_equal(case[2], #records)
+            assert_equal("", records[1001])
+            assert_equal(#bytes, size)
+        else
+            assert_true(#records < 1000)
+            assert_equal("record "..#records, records[#records])
+            assert_true(size <= 1000)
+        end
+        assert_equal("record 1", records[1])
+
+        -- appends follow the last good record
+        j:append("next")
+        j:close()
+        j = assert(bcrc.journal(path, {threads=1}))
+        local again = j:recover()
+        assert_equal(#records + 1, #again)
+        assert_equal("next", again[#again])
+        j:close()
+    end
+    os.remove(path)
+
+    assert_nil(bcrc.journal("/nonexistent/dir/journal"))
+end
+
+function test_small_widths()
+    -- CRC-8/SMBUS, CRC-8/MAXIM (1-Wire), CRC-8/AUTOSAR, CRC-16/CCITT-FALSE,
+    -- CRC-16/ARC, CRC-16/KERMIT
+    local catalogue = {
+        {bcrc.new(8, 0x07), 1, 0xF4},
+        {bcrc.new(8, 0x31, 0, 0, true, true), 1, 0xA1},
+        {bcrc.new(8, 0x2F, 0xFF, 0xFF), 1, 0xDF},
+        {bcrc.new(16, 0x1021, 0xFFFF), 2, 0x29B1},
+        {bcrc.new(16, 0x8005, 0, 0, true, true), 2, 0xBB3D},
+        {bcrc.new(16, 0x1021, 0, 0, true, true), 2, 0x2189},
+        {bcrc.new(16, 0x1021, 0, 0, true, false), 2},
+    }
+
+    for _, c in ipairs(catalogue) do
+        local crc, size = c[1], c[2]
+        if c[3] then
+            assert_equal(c[3], crc("123456789"))
+        end
+        assert_equal(crc("123456789"), crc:reset():process("1234"):process("56789"):checksum())
+
+        -- batches of frames, in groups of 16 lanes, of mixed lengths
+        local frames = {}
+        for i = 1, 70 do
+            local payload = string.rep(string.char(i % 256), i % 5 == 0 and 40 or 8 + i % 3)..i
+            frames[i] = payload..pack(crc(payload), size)
+        end
+        frames[17] = "x"..frames[17]:sub(2)
+        frames[70] = frames[70]:sub(1, -2)
+        assert_equal(2, crc:verify_many(frames, {endian="big"}))
+        local list = select(2, crc:verify_many(frames, {endian="big", list=true}))
+        assert_equal(17, list[1])
+        assert_equal(70, list[2])
+    end
+end
+
+function test_e2e()
+    -- P04: length, counter, data ID and CRC-32P4, big-endian, skipped by the crc
+    local p4 = bcrc.e2e.profile("P04", {data_id=0x0A0B0C0D})
+    local crc32p4 = bcrc.new(32, 0xF4ACFB13, 0xFFFFFFFF, 0xFFFFFFFF, true, true)
+    local msg = string.rep("\0", 12).."payload!"
+    local m1 = p4:protect(msg)
+    assert_equal(pack(20, 2)..pack(0, 2)..pack(0x0A0B0C0D, 4), m1:sub(1, 8))
+    assert_equal(pack(crc32p4(m1:sub(1, 8)..m1:sub(13)), 4), m1:sub(9, 12))
+    local m2 = p4:protect(msg)
+    local m3 = p4:protect(msg)
+    assert_equal(pack(2, 2), m3:sub(3, 4))
+
+    local rx = bcrc.e2e.profile("P04", {data_id=0x0A0B0C0D})
+    local status, counter = rx:check(m1)
+    assert_equal("OK", status)
+    assert_equal(0, counter)
+    assert_equal("REPEATED", rx:check(m1))
+    assert_equal("WRONGSEQUENCE", rx:check(m3))
+    assert_equal("ERROR", rx:check(m2:sub(1, -2).."?"))
+    assert_equal("ERROR", rx:check(m2.."x"))
+    assert_equal("ERROR", bcrc.e2e.profile("P04", {data_id=1}):check(m2))
+    assert_equal("ERROR", rx:check("short"))
+
+    -- in place, at an offset
+    local b = bcrc.buffer(24)
+    local p4at = bcrc.e2e.profile("P04", {data_id=7, offset=4})
+    assert_equal(b, p4at:protect(b))
+    assert_equal("OK", bcrc.e2e.profile("P04", {data_id=7, offset=4}):check(b:tostring()))
+
+    -- P05: little-endian CRC-16/CCITT-FALSE then counter, data ID covered last
+    local p5 = bcrc.e2e.profile("P05", {data_id=0x1234})
+    local m = p5:protect("\0\0\0abcdef")
+    assert_equal(0, m:byte(3))
+    assert_equal(pack(bcrc.ccitt()(m:sub(3).."\52\18"), 2, true), m:sub(1, 2))
+    assert_equal("OK", bcrc.e2e.profile("P05", {data_id=0x1234}):check(m))
+
+    -- P02: CRC-8H2F over the message then the data ID for the counter
+    local list = {}
+    for i = 1, 16 do list[i] = 0x10 + i end
+    local p2 = bcrc.e2e.profile("P02", {data_id_list=list})
+    p2:protect("\0\0xyz")
+    m = p2:protect("\0\0xyz")
+    assert_equal(1, m:byte(2) % 16)
+    assert_equal(bcrc.new(8, 0x2F, 0xFF, 0xFF)(m:sub(2)..string.char(list[2])), m:byte(1))
+
+    -- P01: CRC-8/SAE-J1850 from 0, over the data ID then the message
+    local p1 = bcrc.e2e.profile("P01", {data_id=0x0123})
+    local rx1 = bcrc.e2e.profile("P01", {data_id=0x0123})
+    for i = 0, 15 do
+        m = p1:protect("\0\0abc")
+        assert_equal(i % 15, m:byte(2) % 16)
+        assert_equal(bcrc.new(8, 0x1D)("\35\1"..m:sub(2)), m:byte(1))
+        assert_equal("OK", rx1:check(m))
+    end
+    local nib = bcrc.e2e.profile("P01", {data_id=0x0123, data_id_mode="nibble"})
+    m = nib:protect("\0\0abc")
+    assert_equal(1, math.floor(m:byte(2) / 16))
+    assert_equal(bcrc.new(8, 0x1D)("\35\0"..m:sub(2)), m:byte(1))
+    assert_equal("ERROR", bcrc.e2e.profile("P01", {data_id=0x0223, data_id_mode="nibble"}):check(m))
+
+    -- P07: CRC-64, length, counter, data ID
+    local p7 = bcrc.e2e.profile("P07", {data_id=0xDEADBEEF})
+    m = p7:protect(string.rep("\0", 20).."payload")
+    assert_equal(pack(27, 4)..pack(0, 4)..pack(0xDEADBEEF, 4), m:sub(9, 20))
+    local rx7 = bcrc.e2e.profile("P07", {data_id=0xDEADBEEF, max_delta_counter=2})
+    assert_equal("OK", rx7:check(m))
+    p7:protect(m)
+    assert_equal("OK", rx7:check(p7:protect(m)))
+    assert_equal("ERROR", rx7:check(m:sub(1, 20).."Payload"))
+
+    assert_error(function() bcrc.e2e.profile("P03") end)
+    assert_error(function() bcrc.e2e.profile("P02") end)
+    assert_error(function() p4:protect("short") end)
+end
+
+function test_mpegts()
+    local mpeg2 = bcrc.mpeg2()
+    assert_equal(0x0376E6E7, mpeg2("123456789"))
+    assert_equal(mpeg2("123456789"), bcrc.new(32, 0x04C11DB7, 0xFFFFFFFF, 0, false, false)("123456789"))
+
+    local function section(table_id, body)
+        local s = string.char(table_id)..pack(0xB000 + #body + 4, 2)..body
+        return s..pack(mpeg2(s), 4)
+    end
+    local function packet(pid, pusi, cc, payload)
+        local p = "\71"..pack((pusi and 0x4000 or 0) + pid, 2)..string.char(0x10 + cc)..payload
+        return p..string.rep("\255", 188 - #p)
+    end
+
+    -- program 1 with its PMT on 0x100, and a PMT longer than a packet
+    local pat = section(0, "\0\1\193\0\0".."\0\1\225\0")
+    local pmt = section(2, "\0\1\193\0\0".."\226\0\240\0".."\2\226\0\240\250"..string.rep("d", 250))
+    local bad = pmt:sub(1, 100).."X"..pmt:sub(102)
+    local sdt = section(0x42, "\0\1\193\0\0".."sdt")
+    assert_true(#pmt > 184)
+
+    local ts = table.concat{
+        packet(0, true, 0, "\0"..pat),
+        packet(0, true, 0, "\0"..pat),
+        packet(0x100, true, 0, "\0"..pmt:sub(1, 183)),
+        packet(0x100, false, 1, pmt:sub(184)),
+        packet(0x200, false, 0, "video"),
+        "junk",
+        packet(0x200, false, 1, "video"),
+        packet(0x200, false, 3, "video"),
+        packet(0x100, true, 2, "\0"..bad:sub(1, 183)),
+        packet(0x100, false, 3, bad:sub(184)),
+        packet(0x11, true, 0, "\0"..sdt..sdt),
+        -- a section split across packets, its second packet lost
+        packet(0x100, true, 4, "\0"..pmt:sub(1, 183)),
+        packet(0x100, true, 6, "\0"..pat),
+    }
+
+    local pids, packets, resyncs, errors = bcrc.mpegts(ts, {data=true})
+    assert_equal(12, packets)
+    assert_equal(1, resyncs)
+    assert_equal(0, errors)
+    assert_equal(2, pids[0].packets)
+    assert_equal(1, pids[0].sections)
+    assert_equal(1, pids[0].tables[0])
+    assert_equal(0, pids[0].crc_errors)
+    assert_equal(2, pids[0x100].tables[2])
+    assert_equal(1, pids[0x100].crc_errors)
+    assert_equal(1, pids[0x100].cc_errors)
+    -- sections of any table_id are counted, on any PID of sections
+    assert_equal(1, pids[0x100].tables[0])
+    assert_equal(3, pids[0x200].packets)
+    assert_equal(1, pids[0x200].cc_errors)
+    assert_nil(pids[0x200].sections)
+    assert_equal(2, pids[0x11].tables[0x42])
+    assert_nil(pids[0x12])
+
+    -- M2TS, from a file
+    local path = os.tmpname()
+    local f = assert(io.open(path, "wb"))
+    f:write("TIME"..packet(0, true, 0, "\0"..pat).."TIME"..packet(0x100, true, 0, "\0"..pmt:sub(1, 183)))
+    f:close()
+    pids = bcrc.mpegts(path, {packet_size=192})
+    os.remove(path)
+    assert_equal(1, pids[0].sections)
+    assert_equal(1, pids[0x100].packets)
+    assert_equal(0, pids[0x100].sections)
+
+    assert_nil(bcrc.mpegts(path))
+    assert_error(function() bcrc.mpegts(ts, {data=true, packet_size=100}) end)
+end
+
+function test_assembler()
+    local object = {}
+    for i = 1, 10000 do object[i] = string.char((i * 7919) % 251) end
+    object = table.concat(object)
+
+    -- segments of varying size, added out of order, alternately as bytes and crcs
+    local segments = {}
+    local at = 0
+    for size in function() return at < #object and (at * 13) % 997 + 1 or nil end do
+        segments[#segments + 1] = {at, object:sub(at + 1, at + size)}
+        at = at + size
+    end
+    for i = 1, #segments, 2 do
+        segments[i], segments[#segments + 1 - i] = segments[#segments + 1 - i], segments[i]
+    end
+
+    for _, crc in ipairs{bcrc.crc32(), bcrc.xmodem(), bcrc.ccitt(), bcrc.mpeg2(),
+            bcrc.new(8, 0x2F, 0xFF, 0xFF), bcrc.new(16, 0x1021, 0, 0, true, false)} do
+        local a = bcrc.assembler(crc, #object)
+        for i, s in ipairs(segments) do
+            if i % 2 == 0 then
+                assert_equal(a, a:add(s[1], s[2]))
+            else
+                assert_equal(a, a:add(s[1], crc(s[2]), #s[2]))
+            end
+            if i < #segments then
+                assert_nil(a:checksum())
+            end
+        end
+        assert_equal(crc(object), a:checksum())
+    end
+
+    local crc = bcrc.crc32()
+    local a = bcrc.assembler(crc, 100)
+    a:add(10, object:sub(11, 30))
+    assert_nil(a:checksum())
+    assert_equal(80, select(2, a:checksum()))
+    -- bytes already covered are skipped, an exact repeat of a crc is ignored
+    a:add(0, object:sub(1, 50))
+    a:add(60, crc(object:sub(61, 100)), 40)
+    a:add(60, crc(object:sub(61, 100)), 40)
+    a:add(0, pack(crc(object:sub(1, 20)), 4), 20)
+    assert_error(function() a:add(40, crc(object:sub(41, 70)), 30) end)
+    assert_error(function() a:add(70, 2^32, 10) end)
+    assert_error(function() a:add(70, -1, 10) end)
+    assert_error(function() a:add(70, "\0\0\0", 10) end)
+    assert_error(function() a:add(90, object:sub(91, 111)) end)
+    a:add(50, pack(crc(object:sub(51, 60)), 4), 10)
+    assert_equal(crc(object:sub(1, 100)), a:checksum())
+
+    assert_equal(crc(""), bcrc.assembler(crc, 0):checksum())
+end
+
+function test_braided()
+    local data = {}
+    for i = 1, 50000 do data[i] = string.char((i * 31 + math.floor(i / 7)) % 256) end
+    data = table.concat(data)
+
+    for _, crc in ipairs{bcrc.new(32, 0x04C11DB7, 0xFFFFFFFF, 0xFFFFFFFF, true, true),
+            bcrc.new(32, 0x04C11DB7, 0xFFFFFFFF, 0, false, false),
+            bcrc.new(24, 0x864CFB, 0xB704CE),
+            bcrc.new(16, 0x1021, 0xFFFF),
+            bcrc.new(16, 0x8005, 0, 0, true, true),
+            bcrc.new(8, 0x07)} do
+        -- long buffers are braided, short ones serial, and the bitwise crc is the reference
+        crc:shadow(1)
+        for _, len in ipairs{8192, 16383, 16384, 40000, 50000} do
+            local sum = crc(data, 1, len)
+            crc:reset()
+            for at = 1, len, 1000 do
+                crc:process(data, at, math.min(at + 999, len))
+            end
+            assert_equal(sum, crc:checksum())
+        end
+        local samples, mismatches = crc:shadow_stats()
+        assert_true(samples > 0)
+        assert_equal(0, mismatches)
+    end
+
+    assert_equal(bcrc.crc32()(data), bcrc.new(32, 0x04C11DB7, 0xFFFFFFFF, 0xFFFFFFFF, true, true)(data))
+    assert_equal(bcrc.mpeg2()(data), bcrc.new(32, 0x04C11DB7, 0xFFFFFFFF, 0, false, false)(data))
+    -- CRC-24/OPENPGP
+    assert_equal(0x21CF02, bcrc.new(24, 0x864CFB, 0xB704CE)("123456789"))
+end